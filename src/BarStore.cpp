@@ -0,0 +1,297 @@
+#include "Arduino.h"
+#include "BarStore.h"
+#include <LittleFS.h>
+
+#define BARSTORE_CHUNK 32  // Records per read/write when streaming a file.
+
+BarStore::BarStore()
+{
+  _count = 0;
+  _mounted = false;
+  _loadBytes = 0;
+  _loadUs = 0;
+  _writes = 0;
+  _writeBytes = 0;
+  _writeUs = 0;
+  _maxWriteUs = 0;
+  _compacts = 0;
+  _compactUs = 0;
+}
+
+bool BarStore::begin()
+{
+  // Formats the partition the first time round.
+  _mounted = LittleFS.begin(true);
+  if (!_mounted) {
+    ESP_LOGE("CCD", "BarStore: LittleFS mount failed");
+    return false;
+  }
+  if (!LittleFS.exists(BARSTORE_DIR)) LittleFS.mkdir(BARSTORE_DIR);
+  ESP_LOGI("CCD", "BarStore: %u of %u bytes used", (unsigned)LittleFS.usedBytes(), (unsigned)LittleFS.totalBytes());
+  return true;
+}
+
+// "^GSPC" isn't a great file name.
+void BarStore::path(YahooFin* yf, char* buf)
+{
+  char* p = buf + sprintf(buf, BARSTORE_DIR "/");
+  for (const char* s = yf->getSymbol(); *s && p - buf < 28; s++) *p++ = isalnum(*s) ? *s : '_';
+  strcpy(p, ".bin");
+}
+
+bool BarStore::readHeader(const char* file, BarFileHeader* h)
+{
+  if (!LittleFS.exists(file)) return false;
+  File f = LittleFS.open(file, "r");
+  if (!f) return false;
+  bool ok = f.read((uint8_t*)h, sizeof(*h)) == sizeof(*h)
+         && h->magic == BARSTORE_MAGIC && h->version == BARSTORE_VERSION && h->intervalSecs == CHART_INTERVAL_SECS
+         && f.size() >= sizeof(*h) + h->count * sizeof(BarRecord);
+  f.close();
+  return ok;
+}
+
+BarStore::Slot* BarStore::slotFor(YahooFin* yf)
+{
+  for (int i = 0; i < _count; i++) {
+    if (_slots[i].yf == yf) return &_slots[i];
+  }
+  if (_count >= BARSTORE_MAX_SYMBOLS) return NULL;
+
+  Slot& slot = _slots[_count++];
+  slot.yf = yf;
+  slot.pendingCount = 0;
+  slot.pendingSince = 0;
+  slot.storedUntil = 0;
+
+  char file[40];
+  BarFileHeader h;
+  path(yf, file);
+  if (_mounted && readHeader(file, &h)) slot.storedUntil = h.lastTime;
+  return &slot;
+}
+
+// Put the most recent session on flash into yf. Returns the number of bars loaded.
+int BarStore::load(YahooFin* yf)
+{
+  Slot* slot = slotFor(yf);
+  if (!_mounted || !slot) return 0;
+
+  char file[40];
+  BarFileHeader h;
+  path(yf, file);
+  if (!readHeader(file, &h) || h.count == 0) return 0;
+
+  // Local midnight of the last stored bar's day.
+  time_t last = h.lastTime;
+  struct tm day;
+  localtime_r(&last, &day);
+  day.tm_hour = 0;
+  day.tm_min = 0;
+  day.tm_sec = 0;
+  uint32_t sessionStart = mktime(&day);
+
+  unsigned long start = micros();
+  File f = LittleFS.open(file, "r");
+  f.seek(sizeof(h));
+
+  BarRecord buf[BARSTORE_CHUNK];
+  int n = 0;
+  uint32_t remaining = h.count;
+  while (remaining > 0) {
+    int want = min(remaining, (uint32_t)BARSTORE_CHUNK);
+    if (f.read((uint8_t*)buf, want * sizeof(BarRecord)) != want * sizeof(BarRecord)) break;
+    remaining -= want;
+    for (int i = 0; i < want; i++) {
+      if (buf[i].time < sessionStart || n >= MAX_MINUTE_QUOTES) continue;
+      yf->minuteTimes[n] = buf[i].time;
+      yf->minuteQuotes[n] = buf[i].close;
+      yf->minuteVolumes[n] = buf[i].volume;
+      n++;
+    }
+  }
+  f.close();
+  unsigned long us = micros() - start;
+
+  if (n > 0) {
+    yf->minuteDataPoints = n;
+    yf->firstBarTime = yf->minuteTimes[0];
+    yf->lastBarTime = yf->minuteTimes[n - 1];
+    yf->refreshIndicators(0);
+  }
+
+  uint32_t bytes = sizeof(h) + (h.count - remaining) * sizeof(BarRecord);
+  _loadBytes = bytes;
+  _loadUs = us;
+  ESP_LOGI("CCD", "BarStore: loaded %d of %u bars for %s, %u bytes in %luus",
+           n, (unsigned)h.count, yf->getSymbol(), (unsigned)bytes, us);
+  return n;
+}
+
+// Queue every completed bar newer than what's already stored. The last bar may still be
+// forming, so it waits until the next one starts.
+void BarStore::capture(YahooFin* yf)
+{
+  Slot* slot = slotFor(yf);
+  if (!_mounted || !slot) return;
+
+  int last = yf->minuteDataPoints - 1;  // Excluded.
+  if (yf->volumeGapFrom) {
+    while (last > 0 && yf->minuteTimes[last - 1] >= yf->volumeGapFrom) last--;  // No volume yet.
+  }
+  int i = last;
+  while (i > 0 && yf->minuteTimes[i - 1] > slot->storedUntil) i--;
+
+  for (; i < last; i++) {
+    if (yf->minuteTimes[i] <= slot->storedUntil) continue;
+    if (slot->pendingCount == BARSTORE_BATCH) writeSlot(*slot);
+    if (slot->pendingCount == 0) slot->pendingSince = millis();
+
+    BarRecord& r = slot->pending[slot->pendingCount++];
+    r.time = yf->minuteTimes[i];
+    r.close = yf->minuteQuotes[i];
+    r.volume = yf->minuteVolumes[i];
+    slot->storedUntil = r.time;
+  }
+}
+
+void BarStore::flush(bool force)
+{
+  for (int i = 0; i < _count; i++) {
+    Slot& slot = _slots[i];
+    if (slot.pendingCount == 0) continue;
+    if (force || millis() - slot.pendingSince > BARSTORE_FLUSH_SECS * 1000UL) writeSlot(slot);
+  }
+}
+
+// Records go down before the header. If power drops in between, the header still has the
+// old count and the stray records just get overwritten next time.
+void BarStore::writeSlot(Slot& slot)
+{
+  if (slot.pendingCount == 0) return;
+
+  char file[40];
+  BarFileHeader h;
+  path(slot.yf, file);
+  unsigned long start = micros();
+
+  bool exists = readHeader(file, &h);
+  if (!exists) {
+    h.magic = BARSTORE_MAGIC;
+    h.version = BARSTORE_VERSION;
+    h.intervalSecs = CHART_INTERVAL_SECS;
+    h.count = 0;
+    h.firstTime = slot.pending[0].time;
+    h.lastTime = 0;
+  }
+
+  File f = LittleFS.open(file, exists ? "r+" : "w");
+  if (!f) {
+    ESP_LOGE("CCD", "BarStore: can't open %s", file);
+    slot.pendingCount = 0;
+    return;
+  }
+  if (!exists) f.write((uint8_t*)&h, sizeof(h));
+
+  // Nothing older than the file's newest bar, in case storedUntil was reset by a reboot.
+  int first = 0;
+  while (first < slot.pendingCount && slot.pending[first].time <= h.lastTime) first++;
+  int n = slot.pendingCount - first;
+
+  if (n > 0) {
+    f.seek(sizeof(h) + h.count * sizeof(BarRecord));
+    f.write((uint8_t*)&slot.pending[first], n * sizeof(BarRecord));
+    h.count += n;
+    h.lastTime = slot.pending[slot.pendingCount - 1].time;
+    f.seek(0);
+    f.write((uint8_t*)&h, sizeof(h));
+  }
+  f.close();
+  slot.pendingCount = 0;
+
+  unsigned long us = micros() - start;
+  uint32_t bytes = n * sizeof(BarRecord) + sizeof(h);
+  _writes++;
+  _writeBytes += bytes;
+  _writeUs += us;
+  if (us > _maxWriteUs) _maxWriteUs = us;
+  ESP_LOGI("CCD", "BarStore: wrote %d bars for %s, %u bytes in %luus", n, slot.yf->getSymbol(), (unsigned)bytes, us);
+
+  if (h.count > BARSTORE_MAX_BARS + BARSTORE_COMPACT_SLACK) compact(file, h);
+}
+
+// Keep the newest BARSTORE_MAX_BARS. Written to a temp file and renamed over, so a power
+// cut leaves either the old file or the new one.
+void BarStore::compact(const char* file, BarFileHeader& h)
+{
+  char tmp[44];
+  sprintf(tmp, "%s.tmp", file);
+  unsigned long start = micros();
+
+  File in = LittleFS.open(file, "r");
+  File out = LittleFS.open(tmp, "w");
+  if (!in || !out) {
+    if (in) in.close();
+    if (out) {
+      out.close();
+      LittleFS.remove(tmp);
+    }
+    ESP_LOGE("CCD", "BarStore: can't compact %s", file);
+    return;
+  }
+
+  BarFileHeader nh = h;
+  nh.count = BARSTORE_MAX_BARS;
+  out.write((uint8_t*)&nh, sizeof(nh));
+  in.seek(sizeof(h) + (h.count - BARSTORE_MAX_BARS) * sizeof(BarRecord));
+
+  BarRecord buf[BARSTORE_CHUNK];
+  uint32_t remaining = BARSTORE_MAX_BARS;
+  while (remaining > 0) {
+    int want = min(remaining, (uint32_t)BARSTORE_CHUNK);
+    if (in.read((uint8_t*)buf, want * sizeof(BarRecord)) != want * sizeof(BarRecord)) break;
+    if (remaining == BARSTORE_MAX_BARS) nh.firstTime = buf[0].time;
+    out.write((uint8_t*)buf, want * sizeof(BarRecord));
+    remaining -= want;
+  }
+  in.close();
+
+  if (remaining > 0) {
+    out.close();
+    LittleFS.remove(tmp);
+    ESP_LOGE("CCD", "BarStore: short read compacting %s", file);
+    return;
+  }
+  out.seek(0);
+  out.write((uint8_t*)&nh, sizeof(nh));
+  out.close();
+
+  // LittleFS renames over an existing file atomically. Fall back if the VFS layer won't.
+  if (!LittleFS.rename(tmp, file)) {
+    LittleFS.remove(file);
+    LittleFS.rename(tmp, file);
+  }
+  h = nh;
+  unsigned long us = micros() - start;
+  _compacts++;
+  _compactUs += us;
+  ESP_LOGI("CCD", "BarStore: compacted %s to %u bars in %luus", file, (unsigned)nh.count, us);
+}
+
+// Rates are in kB/s, i.e. bytes per ms.
+void BarStore::report(PubSubClient& mqtt, const char* topic)
+{
+  char msg[224];
+  snprintf(msg, sizeof(msg), "{\"loadBytes\":%u,\"loadUs\":%lu,\"loadKBs\":%lu,\"writes\":%lu,\"writeBytes\":%u,"
+           "\"writeUs\":%lu,\"maxWriteUs\":%lu,\"writeKBs\":%lu,\"compacts\":%lu,\"compactUs\":%lu}",
+           (unsigned)_loadBytes, _loadUs, _loadUs ? (unsigned long)((uint64_t)_loadBytes * 1000 / _loadUs) : 0,
+           _writes, (unsigned)_writeBytes, _writeUs, _maxWriteUs,
+           _writeUs ? (unsigned long)((uint64_t)_writeBytes * 1000 / _writeUs) : 0, _compacts, _compactUs);
+  mqtt.publish(topic, msg);
+  _writes = 0;
+  _writeBytes = 0;
+  _writeUs = 0;
+  _maxWriteUs = 0;
+  _compacts = 0;
+  _compactUs = 0;
+}
@@ -0,0 +1,80 @@
+#include "Arduino.h"
+#include <PubSubClient.h>
+#include "YahooFin.h"
+
+#ifndef BarStore_h
+#define BarStore_h
+
+// Intraday bars kept on LittleFS so a reboot can redraw from flash and only fetch what it
+// missed. One append-only file per symbol, /bars/<symbol>.bin: a BarFileHeader followed by
+// BarRecords, oldest first. Only completed bars are written (never the one still forming),
+// batched in RAM to keep flash wear down. Old bars are dropped once the file passes
+// BARSTORE_MAX_BARS + BARSTORE_COMPACT_SLACK, so it stays a few days deep. Bars still
+// waiting on their volume (built from ticks, or a fleet follower's) aren't written until a
+// chart fetch fills it in.
+//
+// report() publishes the flash timings: the boot load, and the writes since the last report.
+
+#define BARSTORE_DIR "/bars"
+#define BARSTORE_MAGIC 0x52414243  // "CBAR"
+#define BARSTORE_VERSION 1
+#define BARSTORE_MAX_SYMBOLS 4
+#define BARSTORE_BATCH 16                       // ~30 minutes of 2m bars per write.
+#define BARSTORE_FLUSH_SECS 900                 // Or sooner, if they've waited this long.
+#define BARSTORE_MAX_BARS (5 * MAX_MINUTE_QUOTES)  // Five sessions.
+#define BARSTORE_COMPACT_SLACK MAX_MINUTE_QUOTES   // Rewrite at most about once a day.
+
+struct __attribute__((packed)) BarFileHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t intervalSecs;
+  uint32_t count;
+  uint32_t firstTime;
+  uint32_t lastTime;
+};
+
+struct __attribute__((packed)) BarRecord
+{
+  uint32_t time;
+  float close;
+  float volume;
+};
+
+class BarStore
+{
+  public:
+    BarStore();
+    bool begin();
+    int load(YahooFin* yf);
+    void capture(YahooFin* yf);
+    void flush(bool force);
+    void report(PubSubClient& mqtt, const char* topic);
+
+  private:
+    struct Slot {
+      YahooFin* yf;
+      uint32_t storedUntil;     // Newest bar on flash or already queued.
+      BarRecord pending[BARSTORE_BATCH];
+      int pendingCount;
+      unsigned long pendingSince;
+    };
+    Slot* slotFor(YahooFin* yf);
+    void path(YahooFin* yf, char* buf);
+    bool readHeader(const char* file, BarFileHeader* h);
+    void writeSlot(Slot& slot);
+    void compact(const char* file, BarFileHeader& h);
+    Slot _slots[BARSTORE_MAX_SYMBOLS];
+    int _count;
+    bool _mounted;
+    uint32_t _loadBytes;        // The last load().
+    unsigned long _loadUs;
+    unsigned long _writes;      // Since the last report, as are the rest.
+    uint32_t _writeBytes;
+    unsigned long _writeUs;
+    unsigned long _maxWriteUs;
+    unsigned long _compacts;
+    unsigned long _compactUs;
+};
+
+#endif
@@ -44,30 +44,321 @@
 #include <PubSubClient.h>
 #include <107-Arduino-Debug.hpp>
 #include "YahooFin.h"
+#include "QuoteFetcher.h"
+#include "MemTelemetry.h"
+#include "QuoteStream.h"
+#include "QuoteFleet.h"
+#include "IntradayIndicators.h"
+#include "BarStore.h"
+#include "PowerManager.h"
+#include "NexUI.h"
+#include "QuoteView.h"
 #include "CCSecrets.h" //Tokens, passwords, etc.
 
 DEBUG_INSTANCE(160, Serial);
 
 void getNtpTime();
+void prefetchFrom(int page);
 
 
 // restClient is used to make API requests via the HomeAssistant server to control the Sonos.
 RestClient restClient = RestClient(haServer, 8123);
 
 EasyNex myNex(Serial2);
+NexUI nexUI(Serial2);  // Everything on the refresh path goes through the registry in NexUI.h.
 
 WiFiClient (espClient);
 PubSubClient client(espClient);
 
+// Display, radio and CPU sleep through the quiet hours; touch or MQTT wakes them.
+PowerManager power(myNex, Serial2, client);
+bool quietHours = false;
+
+// Quotes are fetched in the background. Three workers covers the home page watchlist in
+// about one round trip; raise it for a longer list if the heap allows.
+#define FETCH_MAX_IN_FLIGHT 3
+#define FETCH_DEADLINE_MS 8000
+QuoteFetcher fetcher(FETCH_MAX_IN_FLIGHT, FETCH_DEADLINE_MS);
+
+YahooFin acn = YahooFin("ACN");
+YahooFin sp500 = YahooFin("^GSPC");
+YahooFin nasdaq = YahooFin("^IXIC");
+
+// Home page (page0) watchlist. Fetch tags for these are the index into this table.
+struct WatchItem {
+  YahooFin* yf;
+  NexComponent field;
+};
+WatchItem watchlist[] = {
+  { &acn, ui::tAcn },
+  { &sp500, ui::tSP },
+  { &nasdaq, ui::tNAS },
+};
+#define WATCHLIST_LEN ((int)(sizeof(watchlist) / sizeof(watchlist[0])))
+#define TAG_GRAPH 100
+int homeQuotesPending = 0;
+// Watchlist refresh wall time, first request out to last quote back. Published to
+// stat/DesktopBuddy/batch; it's what FETCH_MAX_IN_FLIGHT gets tuned against.
+unsigned long homeBatchStart = 0;
+int homeBatchSize = 0;
+YahooFin* graphSymbol = &acn;
+
+// Overlays on the graph page waveform (s0), on the GRAPH_CH_* channels after price and
+// previous close. The HMI needs s0 set to 4 channels before turning these on, or the
+// extra adds are rejected. GRAPH_MA_SMA (QuoteView.h) picks the moving average.
+#ifndef GRAPH_OVERLAYS
+#define GRAPH_OVERLAYS 0
+#endif
+IntradayIndicators graphIndicators(20, 9);
+
+// Completed bars for the graphed symbol, kept across reboots.
+BarStore barStore;
+
+// Streamed quotes. When the stream is up the minute poll is skipped. Override the endpoint
+// in build_flags to run against a local stand-in feed, e.g.
+//   -DQUOTE_STREAM_HOST=\"192.168.1.50\" -DQUOTE_STREAM_PORT=8765 -DQUOTE_STREAM_SSL=false
+// -DUSE_QUOTE_STREAM=0 leaves it out and polls every minute as before.
+#ifndef USE_QUOTE_STREAM
+#define USE_QUOTE_STREAM 1
+#endif
+#ifndef QUOTE_STREAM_HOST
+#define QUOTE_STREAM_HOST "streamer.finance.yahoo.com"
+#endif
+#ifndef QUOTE_STREAM_PORT
+#define QUOTE_STREAM_PORT 443
+#endif
+#ifndef QUOTE_STREAM_PATH
+#define QUOTE_STREAM_PATH "/"
+#endif
+#ifndef QUOTE_STREAM_SSL
+#define QUOTE_STREAM_SSL true
+#endif
+// Ticks can come several times a second. A quote field is a few dozen UART bytes, but a full
+// graph redraw is ~9K, which is most of a second at 115200 before the Nextion even parses it.
+#define QUOTE_REDRAW_MS 1000
+#define GRAPH_REDRAW_MS 5000
+QuoteStream quoteStream(QUOTE_STREAM_HOST, QUOTE_STREAM_PORT, QUOTE_STREAM_PATH, QUOTE_STREAM_SSL);
+
+// Fleet mode: one display fetches and shares over MQTT, the rest follow. FLEET_AUTO elects
+// through the broker; pin a unit with -DFLEET_ROLE=FLEET_LEADER (or FLEET_FOLLOWER).
+#ifndef FLEET_ROLE
+#define FLEET_ROLE FLEET_AUTO
+#endif
+QuoteFleet fleet(client, FLEET_ROLE);
+
+// Page switch to fully drawn page, published to stat/DesktopBuddy/page for each switch.
+#define STALE_SECS 60
+#define TAG_PREFETCH 101
+struct PageTimer {
+  int page;
+  unsigned long enteredAt;
+  bool fromCache;
+  bool pending;
+};
+PageTimer pageTimer = { -1, 0, false, false };
+
+void pageDrawn(int page)
+{
+  if (!pageTimer.pending || pageTimer.page != page) return;
+  pageTimer.pending = false;
+
+  char msg[64];
+  sprintf(msg, "{\"page\":%d,\"ms\":%lu,\"cached\":%s}", page, millis() - pageTimer.enteredAt, pageTimer.fromCache ? "true" : "false");
+  ESP_LOGI("CCD", "Page drawn: %s", msg);
+  client.publish("stat/DesktopBuddy/page", msg);
+  power.resumed(page);  // If this is the redraw after a wake.
+}
+
+bool quoteIsStale(YahooFin* yf)
+{
+  return yf->regularMarketPrice == 0 || (yf->isMarketOpen() && time(NULL) - yf->lastUpdateTime > STALE_SECS);
+}
+
+// Every home page quote has data and none is mid-fetch.
+bool homeReady()
+{
+  for (int i = 0; i < WATCHLIST_LEN; i++) {
+    if (watchlist[i].yf->fetchPending || watchlist[i].yf->regularMarketPrice == 0) return false;
+  }
+  return true;
+}
+
+// Streamed ticks keep the chart fresh, but the bars they build have no volume. Once such a
+// bar has closed, fetch again so its volume (and VWAP) catch up.
+bool chartIsStale(YahooFin* yf)
+{
+  if (yf->minuteDataPoints == 0) return true;
+  if (!yf->isMarketOpen()) return false;
+  time_t now = time(NULL);
+  return now - yf->lastChartTime > STALE_SECS || (yf->volumeGapFrom && now - yf->volumeGapFrom > CHART_INTERVAL_SECS + STALE_SECS);
+}
+
 #define ARDUINOJSON_USE_LONG_LONG 1
 #define ARDUINOJSON_USE_DOUBLE 1
 
 const char* ssid = STASSID;
 const char* password = STAPSK;
 
-char playerState[20];
-int trackDuration;
-int trackPosition;
+// Media player state as last written to page3. Both the per-topic and the JSON feeds go
+// through this, so each field is only sent to the Nextion when it actually changes.
+struct MediaState {
+  char state[20];
+  int volume;           // 0-100
+  char track[101];
+  char artist[101];
+  int duration;         // seconds
+  int position;         // seconds, as of positionUpdated
+  time_t positionUpdated;
+};
+MediaState media = { "", -1, "", "", -1, -1, 0 };
+
+// One JSON message per player instead of seven retained topics. HA automation publishes e.g.
+// {"state":"playing","volume":0.35,"track":"...","artist":"...","duration":215,
+//  "position":12,"position_last_update":"2023-12-01 16:20:05+00:00"}
+// Off by default: the legacy homeassistant/media_player/# feed is still what most setups
+// publish, and it picks up the JSON topic too. Build with -DUSE_MEDIA_JSON=1 once the HA
+// automation is in, to subscribe to that topic alone.
+#ifndef USE_MEDIA_JSON
+#define USE_MEDIA_JSON 0
+#endif
+#define MEDIA_STATE_TOPIC "homeassistant/media_player/sonos_5/json"
+// Two 100 char strings, keys, a timestamp and the MQTT header, with room to spare for
+// longer titles (they get cut to 100 on display anyway). A full day's fleet series is
+// bigger still: 8 + 6 * 195 bytes plus the topic.
+#define MQTT_BUFFER_SIZE 1280
+
+// HA's "YYYY-MM-DD HH:MM:SS+00:00" to epoch seconds. It's always UTC, so no need to go
+// through mktime() and the local timezone.
+time_t parseUtcTimestamp(const char* s)
+{
+  int yr, mo, da, hr, mn, se;
+  if (sscanf(s, "%d-%d-%d%*c%d:%d:%d", &yr, &mo, &da, &hr, &mn, &se) != 6) return 0;
+
+  // Days since 1970-01-01 (Howard Hinnant's days_from_civil).
+  yr -= mo <= 2;
+  long era = (yr >= 0 ? yr : yr - 399) / 400;
+  long yoe = yr - era * 400;
+  long doy = (153 * (mo + (mo > 2 ? -3 : 9)) + 2) / 5 + da - 1;
+  long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  long days = era * 146097 + doe - 719468;
+
+  return (time_t)days * 86400 + hr * 3600 + mn * 60 + se;
+}
+
+void showVolume(int vol)
+{
+  if (vol == media.volume) return;
+  media.volume = vol;
+  ESP_LOGI("CCD","%s","Volume: %d", vol);
+  nexUI.setNum(ui::jVolume, ui::val, vol);
+}
+
+void showTrack(const char* track)
+{
+  if (!strncmp(track, media.track, sizeof(media.track) - 1)) return;
+  strlcpy(media.track, track, sizeof(media.track));
+  ESP_LOGI("CCD","%s","track: %s", media.track);
+  nexUI.setText(ui::tTrack, ui::txt, media.track);
+}
+
+void showArtist(const char* artist)
+{
+  if (!strncmp(artist, media.artist, sizeof(media.artist) - 1)) return;
+  strlcpy(media.artist, artist, sizeof(media.artist));
+  ESP_LOGI("CCD","%s","Artist: %s", media.artist);
+  nexUI.setText(ui::tArtist, ui::txt, media.artist);
+}
+
+void showPlayerState(const char* state)
+{
+  if (!strncmp(state, media.state, sizeof(media.state) - 1)) return;
+  strlcpy(media.state, state, sizeof(media.state));
+  ESP_LOGI("CCD","%s","State: %s", media.state);
+  // Change button to show current state icon 9 is pause icon. icon 10 is play.
+  // Pause the elapsed time ticker as well.
+  if (!strcmp("playing", media.state)) {
+    power.wake(POWER_WAKE_MQTT);  // Someone's put music on; they'll want the controls.
+    nexUI.setNum(ui::tmProgress, ui::en, 1);
+    nexUI.setNum(ui::bPlayPause, ui::pic, ui::picPause);
+    // myNex.writeStr("vis p7,1");
+  } else {
+    nexUI.setNum(ui::tmProgress, ui::en, 0);
+    nexUI.setNum(ui::bPlayPause, ui::pic, ui::picPlay);
+    // myNex.writeStr("vis p7,0");
+  }
+}
+
+void showDuration(int duration)
+{
+  if (duration == media.duration) return;
+  media.duration = duration;
+
+  // We'll use that timer to update the progress. Since progress is always 0-100, we need to set the timer
+  // to tick every 1% of the track. Timer is in ms. Duration in seconds. Progress bar in %. So, multiply by 1000/100=10.
+  nexUI.setNum(ui::tmProgress, ui::tim, media.duration * 10);
+  ESP_LOGI("CCD","%s","Duration: %d", media.duration);
+}
+
+// Position is only meaningful together with the time HA took it. While playing, wind it
+// forward to now so a late or retained message still puts the bar in the right place.
+void showProgress()
+{
+  if (media.duration <= 0 || media.position < 0 || media.positionUpdated == 0) return;
+
+  int pos = media.position;
+  if (!strcmp("playing", media.state)) pos += time(NULL) - media.positionUpdated;
+  int curOffset = constrain((pos * 100) / media.duration, 0, 100); // Calculate what pct of track has been played.
+  ESP_LOGI("CCD", "Progress: %d%%", curOffset);
+  nexUI.setNum(ui::jProgress, ui::val, curOffset);
+}
+
+// Send page3 everything again, e.g. after the Nextion has slept through some updates.
+void redrawMedia()
+{
+  MediaState last = media;
+  media = { "", -1, "", "", -1, last.position, last.positionUpdated };
+  showTrack(last.track);
+  showArtist(last.artist);
+  if (last.state[0]) showPlayerState(last.state);
+  if (last.volume >= 0) showVolume(last.volume);
+  if (last.duration >= 0) showDuration(last.duration);
+  showProgress();
+}
+
+// Parse the whole player state once and only touch what changed.
+void mediaJsonCallback(byte* payload, unsigned int length)
+{
+  StaticJsonDocument<160> filter;
+  filter["state"] = true;
+  filter["volume"] = true;
+  filter["track"] = true;
+  filter["artist"] = true;
+  filter["duration"] = true;
+  filter["position"] = true;
+  filter["position_last_update"] = true;
+
+  // Zero-copy: strings stay in the payload, so this only needs to hold the slots.
+  StaticJsonDocument<256> doc;
+  auto err = deserializeJson(doc, (char*)payload, length, DeserializationOption::Filter(filter));
+  if (err) {
+    ESP_LOGE("CCD", "Media state: bad JSON, %s", err.c_str());
+    return;
+  }
+
+  if (doc.containsKey("track")) showTrack(doc["track"] | "");
+  if (doc.containsKey("artist")) showArtist(doc["artist"] | "");
+  if (doc.containsKey("state")) showPlayerState(doc["state"] | "");
+  if (doc.containsKey("volume")) showVolume((int)(doc["volume"].as<float>() * 100));
+  if (doc.containsKey("duration")) showDuration(doc["duration"].as<int>());
+
+  int position = doc["position"] | media.position;
+  time_t updated = doc.containsKey("position_last_update") ? parseUtcTimestamp(doc["position_last_update"] | "") : media.positionUpdated;
+  if (position != media.position || updated != media.positionUpdated || doc.containsKey("duration")) {
+    media.position = position;
+    media.positionUpdated = updated;
+    showProgress();
+  }
+}
 
 
 // MQTT callback for media message
@@ -75,118 +366,62 @@ int trackPosition;
 
 void callback(char* topic, byte* payload, unsigned int length) {
 
+  MEM_SITE("mqttCallback");
   ESP_LOGI("CCD","%s","MQTT Message. Topic: [%s]", topic);
   // Serial.println("Callback.");
 
+  if (fleet.handleMessage(topic, payload, length)) return;
+  if (power.handleMessage(topic, payload, length)) return;
+
   if(!strcmp(topic, "stat/OfficeHeatPlug/POWER")) {
     char powerState[10];
     strncpy(powerState, (char *)payload, 2); //Just grab the ON or OF and check second letter.
     Serial.printf("MQTT Says: Heat Power Plug: %c\n", powerState[1]);
     if(powerState[1] == 'F')
     { 
-      myNex.writeStr("page0.b2.pic=19");
-      myNex.writeStr("heatState.val=0");
+      nexUI.setNum(ui::bHeat, ui::pic, ui::picHeatOff);
+      nexUI.setNum(ui::heatState, ui::val, 0);
     }
     else 
     {
-      myNex.writeStr("page0.b2.pic=33");
-      myNex.writeStr("heatState.val=1");
-    }
-  }
-    
-
-  if (!strcmp(topic, "homeassistant/media_player/volume")) {
-    char bufVol[6];
-    strncpy(bufVol, (char *)payload, length);
-    bufVol[length] = 0;
-    int vol = atof(bufVol) * 100;
-    ESP_LOGI("CCD","%s","Volume: %d", vol);
-    myNex.writeNum("page3.j1.val", vol);
-  }
-
-  if (!strcmp(topic, "homeassistant/media_player/track")) {
-    if (length > 100) length = 100;
-    char track[101];
-    strncpy(track, (char *)payload, length);
-    track[length] = 0;
-    ESP_LOGI("CCD","%s","track: %s", track);
-    myNex.writeStr("page3.tTrack.txt", track);
-  }
-  if (!strcmp(topic, "homeassistant/media_player/state")) {
-    char bufState[20];
-    strncpy(bufState, (char *)payload, length);
-    bufState[length] = 0;
-    strcpy(playerState, bufState);
-    ESP_LOGI("CCD","%s","State: %s", playerState);
-    // Change button to show current state icon 9 is pause icon. icon 10 is play.
-    // Pause the elapsed time ticker as well.
-    if (!strcmp("playing", bufState)) {
-      myNex.writeNum("page3.tm0.en", 1);
-      myNex.writeStr("page3.bPlayPause.pic=9");
-      // myNex.writeStr("vis p7,1");
-    } else {
-      myNex.writeNum("page3.tm0.en", 0);
-      myNex.writeStr("page3.bPlayPause.pic=10");
-      // myNex.writeStr("vis p7,0");
+      nexUI.setNum(ui::bHeat, ui::pic, ui::picHeatOn);
+      nexUI.setNum(ui::heatState, ui::val, 1);
     }
   }
-  if (!strcmp(topic, "homeassistant/media_player/artist")) {
-    if (length > 100) length = 100;
-    char artist[101];
-    strncpy(artist, (char *)payload, length);
-    artist[length] = 0;
-    ESP_LOGI("CCD","%s","Artist: %s", artist);
-    myNex.writeStr("page3.tArtist.txt", artist);
-  }
-  if (!strcmp(topic, "homeassistant/media_player/duration")) {
-    char duration[6];
-    strncpy(duration, (char *)payload, length);
-    duration[length] = 0;
-    trackDuration = atoi(duration);
-
-    // We'll use that timer to update the progress. Since progress is always 0-100, we need to set the timer
-    // to tick every 1% of the track. Timer is in ms. Duration in seconds. Progress bar in %. So, multiply by 1000/100=10.
-    myNex.writeNum("page3.tm0.tim", trackDuration * 10);
-    ESP_LOGI("CCD","%s","Duration: %d", trackDuration);
 
-  }
-  if (!strcmp(topic, "homeassistant/media_player/position")) {
-    char bufPosition[6];
-    strncpy(bufPosition, (char *)payload, length);
-    bufPosition[length] = 0;
-    trackPosition = atoi(bufPosition);
-    ESP_LOGI("CCD","%s","Position: %d", trackPosition);
+  if (!strcmp(topic, MEDIA_STATE_TOPIC)) {
+    mediaJsonCallback(payload, length);
+    return;
   }
 
-  if (!strcmp(topic, "homeassistant/media_player/position_last_update")) {
-    int yr, mo, da, hr, mn, se;
-    struct tm timeinfo;
+  // Legacy one-topic-per-field feed. Same writers, same change filtering.
+  if (strncmp(topic, "homeassistant/media_player/", 27)) return;
+  const char* field = topic + 27;
+
+  char buf[101];
+  if (length > 100) length = 100;
+  strncpy(buf, (char *)payload, length);
+  buf[length] = 0;
+
+  if (!strcmp(field, "volume")) showVolume(atof(buf) * 100);
+  if (!strcmp(field, "track")) showTrack(buf);
+  if (!strcmp(field, "state")) showPlayerState(buf);
+  if (!strcmp(field, "artist")) showArtist(buf);
+  if (!strcmp(field, "duration")) showDuration(atoi(buf));
+  if (!strcmp(field, "position")) {
+    media.position = atoi(buf);
+    ESP_LOGI("CCD","%s","Position: %d", media.position);
+  }
 
-    char bufTime[36];
-    strncpy(bufTime, (char *)payload, length);
-    bufTime[length] = 0;
-
-    sscanf(bufTime, "%d-%d-%d %d:%d:%d\+*", &yr, &mo, &da, &hr, &mn, &se);
-    timeinfo.tm_sec = se;
-    timeinfo.tm_min = mn;
-    timeinfo.tm_hour = hr;
-    timeinfo.tm_mday = da;
-    timeinfo.tm_mon = mo - 1;
-    timeinfo.tm_year = yr - 1900;
-
-    time_t now;
-    time(&now);
-    int diffTime = difftime(mktime(gmtime(&now)), mktime(&timeinfo));
+  if (!strcmp(field, "position_last_update")) {
+    media.positionUpdated = parseUtcTimestamp(buf);
+    int diffTime = time(NULL) - media.positionUpdated;
     ESP_LOGI("CCD","%s","DiffTime: %d", diffTime);
 
     // If this is a new time update, then reset the time.
     // TODO: deal with a mid-track update...messy.
     // Should also check position here...
-    if (diffTime <= 1) {
-      int curOffset = (int)((trackPosition * 100) / trackDuration); // Calculate what pct of track has been played.
-      myNex.writeNum("page3.j0.val", curOffset);
-    }
-
+    if (diffTime <= 1) showProgress();
   }
 
 }
@@ -210,10 +445,17 @@ void reconnect() {
   while (!client.connected()) {
     ESP_LOGI("CCD","%s","Attempting MQTT connection...");
 
-    if (client.connect("DesktopBuddy", "hass.mqtt", "trixie*1", 0, 0, 0, 0, 0)) {
+    power.beforeConnect();
+    if (client.connect(fleet.clientId(), "hass.mqtt", "trixie*1", 0, 0, 0, 0, 0)) {
       ESP_LOGI("CCD","%s","connected");
+#if USE_MEDIA_JSON
+      client.subscribe(MEDIA_STATE_TOPIC);
+#else
       client.subscribe("homeassistant/media_player/#");
+#endif
       client.subscribe("stat/OfficeHeatPlug/POWER");
+      fleet.onConnect();
+      power.onConnect();
     } else {
       ESP_LOGI("CCD","%s","failed to connect to MQTT, Try again in 5 seconds");
       // Wait 5 seconds before retrying
@@ -251,95 +493,20 @@ void setNexionTime()
 }
 
 
-void updateGraph(char * symbol) {
+// Kick off a background refresh of the graph page. drawGraph() runs when the data lands.
+void updateGraph(YahooFin* yf) {
   if (myNex.currentPageId != 2) {
     ESP_LOGI("CCD","%s","Not on page2, skipping graph stuff.");
     return;
   }
+  fetcher.request(yf, FETCH_QUOTE_AND_CHART, TAG_GRAPH);
+}
 
-  // Update the detailed quote on page.
-  char quote_msg[30];
-  YahooFin yf = YahooFin(symbol);
-  yf.getQuote();
-
-  sprintf(quote_msg, "%.2f(%.2f/%.2f%%)", yf.regularMarketPrice, yf.regularMarketChange, yf.regularMarketChangePercent * 100);
-  if (yf.regularMarketChange < 0) myNex.writeNum("t1.pco", 63488);
-  else myNex.writeNum("t1.pco", 34784);
-
-  myNex.writeStr("t1.txt", quote_msg);
-
-  // Update the chart
-  yf.getChart();
-
-  if (yf.minuteDataPoints == 0) return;
-
-  // Clear the graph...we can think about adding on to it later.
-  myNex.writeStr("cle 2,0");
-  myNex.writeStr("cle 2,1");
-
-  // Change the line color based on up/down
-  if (yf.regularMarketChange < 0) myNex.writeNum("s0.pco0", 63488);
-  else myNex.writeNum("s0.pco0", 34784);
-
-  // Figure out scale
-  long scaleLow = floor(min(yf.regularMarketPreviousClose, yf.regularMarketDayLow)) * 100;
-  long scaleHigh = ceil(max(yf.regularMarketPreviousClose, yf.regularMarketDayHigh)) * 100;
-
-  char pc[18];  // pc is the previous close amount for the line.
-  sprintf(pc, "add 2,1,%d", map((long)(yf.regularMarketPreviousClose * 100), scaleLow, scaleHigh, 0, 255));
-
-  int high = 0;
-  int highI = 0;
-  int low = 999;
-  int lowI = 0;
-  int j = 0;
-
-  for (int i = 0; i < yf.minuteDataPoints; i++)
-  {
-
-    if (yf.minuteQuotes[i] > 0) {
-
-      long mappedVal = map((long)(yf.minuteQuotes[i] * 100), scaleLow, scaleHigh, 0, 255);
-
-      if (mappedVal >= high) {
-        high = mappedVal;
-        highI = j;
-      }
-
-      if (mappedVal <= low) {
-        low = mappedVal;
-        lowI = j;
-      }
-
-      myNex.writeStr("add 2,0," + String(mappedVal));
-      myNex.writeStr(pc);
-      j++;
-
-      //Stretch the graph a bit
-      if (i % 3) {
-        myNex.writeStr("add 2,0," + String(mappedVal));
-        myNex.writeStr(pc);
-        j++;
-      }
-    }
-  }
-
-  // Update the min/max/last overlay
-
-  delay(80); //Delay allows the transparent text to work.
-
-  char controlDesc[55];  //"xstr 245, 355,88,26,0,56154,0,0,1,3,123.45" about 45.
-  sprintf(controlDesc, "xstr %d,%d,88,26,0,59164,0,0,1,3,\"%.2f\"", min(245, highI), 255 - high - 4, yf.regularMarketDayHigh);
-  myNex.writeStr(controlDesc);
-
-  sprintf(controlDesc, "xstr %d,%d,88,26,0,59164,0,0,1,3,\"%.2f\"", min(245, lowI), 255 - low + 26, yf.regularMarketDayLow);
-  myNex.writeStr(controlDesc);
-
-  sprintf(controlDesc, "xstr %d,%d,88,26,0,59164,0,0,1,3,\"%.2f\"", min(245, j), 255 - map((long)(yf.regularMarketPreviousClose * 100), scaleLow, scaleHigh, 0, 255), yf.regularMarketPreviousClose);
-  myNex.writeStr(controlDesc);
-
-  return;
-
+void drawGraph(YahooFin* yfp) {
+  if (myNex.currentPageId != 2) return;
+  MEM_SITE("drawGraph");
+  NexPageScope shown(nexUI, 2);
+  if (drawGraphPage(nexUI, *yfp, GRAPH_OVERLAYS)) pageDrawn(2);
 }
 
 // Select the current source for Sonos. Has to be in the Sonos favorites.
@@ -416,9 +583,28 @@ void setup() {
   setNexionTime();
 
   // Setup MQTT
-  // client.setBufferSize(1024); Default size is 256.
+  client.setBufferSize(MQTT_BUFFER_SIZE); // Default size is 256, too small for the JSON media state.
   client.setServer(mqttServer, 1883);
   client.setCallback(callback);
+  power.begin();
+
+  fetcher.begin();
+
+  // setup() runs on the Arduino loop task.
+  memTelemetry.watchTask(xTaskGetCurrentTaskHandle(), "loop");
+  for (int i = 0; i < FETCH_MAX_IN_FLIGHT; i++) {
+    memTelemetry.watchTask(fetcher.getTask(i), pcTaskGetTaskName(fetcher.getTask(i)));
+  }
+
+  for (int i = 0; i < WATCHLIST_LEN; i++) fleet.add(watchlist[i].yf);
+  // Redraw from flash straight away; the first chart fetch then only asks for what's missing.
+  if (barStore.begin()) barStore.load(graphSymbol);
+  graphSymbol->attachIndicators(&graphIndicators);
+
+#if USE_QUOTE_STREAM
+  for (int i = 0; i < WATCHLIST_LEN; i++) quoteStream.add(watchlist[i].yf);
+  quoteStream.begin();
+#endif
 
   myNex.writeStr("page 0"); 
 
@@ -441,7 +627,7 @@ void setNextionBrightness(int brightness)
 }
 
 
-void getQuote(char* symbol, String field)
+void getQuote(char* symbol, const NexComponent& field)
 {
   Serial.printf("Getting quote for %s\n", symbol);
   
@@ -453,49 +639,46 @@ void getQuote(char* symbol, String field)
   {
     sprintf(quote_msg, "$%.2f($%.2f/%.2f%%)", yf.regularMarketPrice, yf.regularMarketChange, yf.regularMarketChangePercent * 100);
 
-    myNex.writeStr(field + ".txt", quote_msg);
+    nexUI.setText(field, ui::txt, quote_msg);
 
-    if (yf.regularMarketChange < 0) myNex.writeNum(field + ".pco", 63488);
-    else myNex.writeNum(field + ".pco", 34784);
+    if (yf.regularMarketChange < 0) nexUI.setColor(field, ui::pco, ui::down);
+    else nexUI.setColor(field, ui::pco, ui::up);
   }
   else
   {
     sprintf(quote_msg, "$%.2f", yf.regularMarketPrice);
 
-    myNex.writeStr(field + ".txt", quote_msg);
-    myNex.writeNum(field + ".pco", 65535);
+    nexUI.setText(field, ui::txt, quote_msg);
+    nexUI.setColor(field, ui::pco, ui::flat);
   }
   Serial.printf("Quote back: %s\n", quote_msg);
   
 }
 
-YahooFin acn = YahooFin("ACN");
-YahooFin sp500 = YahooFin("^GSPC");
-YahooFin nasdaq = YahooFin("^IXIC");
-
-void showQuote(YahooFin* yf, String field)
+// Draw a quote from whatever the YahooFin already holds. No network.
+void showQuote(YahooFin* yf, const NexComponent& field)
 {
-  yf->getQuote();
-  char quote_msg[30];
-  
-  if(yf->isChangeInteresting())
-  {
-//    Serial.println("Change is interesting.");
-    sprintf(quote_msg, "$%.2f($%.2f/%.2f%%)", yf->regularMarketPrice, yf->regularMarketChange, yf->regularMarketChangePercent * 100);
-
-    myNex.writeStr(field + ".txt", quote_msg);
+  MEM_SITE("showQuote");
+  NexPageScope shown(nexUI, myNex.currentPageId);
+  drawQuoteLine(nexUI, *yf, field, yf->isChangeInteresting());
+}
 
-    if (yf->regularMarketChange < 0) myNex.writeNum(field + ".pco", 63488);
-    else myNex.writeNum(field + ".pco", 34784);
+bool requestHomeQuote(int i)
+{
+  if (!fetcher.request(watchlist[i].yf, FETCH_QUOTE, i)) return false;
+  if (homeQuotesPending++ == 0) {
+    homeBatchStart = millis();
+    homeBatchSize = 0;
   }
-  else
-  {
-    sprintf(quote_msg, "$%.2f", yf->regularMarketPrice);
+  homeBatchSize++;
+  return true;
+}
 
-    myNex.writeStr(field + ".txt", quote_msg);
-    myNex.writeNum(field + ".pco", 65535);
-    
-  }
+void homeBatchDone()
+{
+  char msg[80];
+  snprintf(msg, sizeof(msg), "{\"symbols\":%d,\"workers\":%d,\"ms\":%lu}", homeBatchSize, FETCH_MAX_IN_FLIGHT, millis() - homeBatchStart);
+  client.publish("stat/DesktopBuddy/batch", msg);
 }
 
 void updateQuotes()
@@ -505,16 +688,123 @@ void updateQuotes()
     ESP_LOGI("CCD","%s","Not on page0, skipping.");
     return;
   }
-  myNex.writeStr("t7.txt", "updating.");
-  //getQuote("ACN", "tAcn");
-  showQuote(&acn, "tAcn");
-  myNex.writeStr("t7.txt", "updating .");
-  //getQuote("^GSPC", "tSP");
-  showQuote(&sp500, "tSP");
-  myNex.writeStr("t7.txt", "updating  .");
-  //getQuote("^IXIC", "tNAS");
-  showQuote(&nasdaq, "tNAS");
-  myNex.writeStr("t7.txt", "");
+  // All symbols go out together; each one is drawn as it comes back in onFetchDone().
+  for (int i = 0; i < WATCHLIST_LEN; i++) {
+    requestHomeQuote(i);
+  }
+  NexPageScope shown(nexUI, 0);
+  if (homeQuotesPending) nexUI.setText(ui::tStatus, ui::txt, "updating.");
+}
+
+// Redraw whatever the stream or the fleet leader has touched, no faster than the display
+// can take it. The leader passes streamed ticks on to the fleet at the same pace.
+void drawStreamedQuotes()
+{
+  static unsigned long lastQuoteDraw = 0;
+  static unsigned long lastGraphDraw = 0;
+  static bool graphDirty = false;
+
+  if (millis() - lastQuoteDraw >= QUOTE_REDRAW_MS) {
+    lastQuoteDraw = millis();
+    for (int i = 0; i < WATCHLIST_LEN; i++) {
+      bool streamed = quoteStream.takeDirty(watchlist[i].yf);
+      bool shared = fleet.takeDirty(watchlist[i].yf);
+      if (!streamed && !shared) continue;
+      if (streamed) fleet.publishQuote(watchlist[i].yf);
+      if (watchlist[i].yf == graphSymbol) graphDirty = true;
+      if (myNex.currentPageId == 0) showQuote(watchlist[i].yf, watchlist[i].field);
+    }
+  }
+
+  // While a worker is fetching the series it's rewriting it; leave it dirty until then.
+  if (graphDirty && !graphSymbol->fetchPending && millis() - lastGraphDraw >= GRAPH_REDRAW_MS) {
+    lastGraphDraw = millis();
+    graphDirty = false;
+    if (fleet.isLeader()) barStore.capture(graphSymbol);  // A follower's bars have no volume.
+    fleet.publishSeries(graphSymbol);
+    drawGraph(graphSymbol);
+  }
+}
+
+void onFetchDone(FetchJob& job)
+{
+  bool homeQuote = job.tag >= 0 && job.tag < WATCHLIST_LEN;
+  if (homeQuote && homeQuotesPending > 0 && --homeQuotesPending == 0) homeBatchDone();
+
+  // Followers hear about failures too, so they grey out the cached values with us.
+  bool cached = job.yf->regularMarketPrice != 0;
+  if (job.ok || cached) fleet.publishQuote(job.yf);
+  if (job.kind != FETCH_QUOTE && (job.ok || job.yf->minuteDataPoints > 0)) fleet.publishSeries(job.yf);
+  if (job.ok && job.kind != FETCH_QUOTE && fleet.isLeader()) barStore.capture(job.yf);
+
+  // Draw wherever the data is on screen, whoever asked for it. That covers prefetches and
+  // a page entered while its fetch was already in flight. A failed fetch redraws the cached
+  // values, greyed out as stale.
+  if (job.ok || cached) {
+    if (myNex.currentPageId == 2 && job.yf == graphSymbol && (job.kind != FETCH_QUOTE || !job.ok)) drawGraph(job.yf);
+    if (myNex.currentPageId == 0) {
+      for (int i = 0; i < WATCHLIST_LEN; i++) {
+        if (watchlist[i].yf == job.yf) showQuote(job.yf, watchlist[i].field);
+      }
+    }
+  }
+
+  if (myNex.currentPageId == 0) {
+    NexPageScope shown(nexUI, 0);
+    if (homeQuote) nexUI.setText(ui::tStatus, ui::txt, homeQuotesPending ? "updating." : "");
+    if (homeReady()) pageDrawn(0);
+    // The graphed symbol is on the watchlist too, so the chart prefetch was turned away
+    // while its quote was in flight. Now it can go.
+    if (job.yf == graphSymbol && job.kind == FETCH_QUOTE) prefetchFrom(0);
+  }
+}
+
+// Warm the cache for the page the user is most likely to go to next. Page 0 and the graph
+// page are a click apart; the media page (3) usually goes back home.
+void prefetchFrom(int page)
+{
+  if (page == 0) {
+    if (chartIsStale(graphSymbol)) fetcher.request(graphSymbol, quoteIsStale(graphSymbol) ? FETCH_QUOTE_AND_CHART : FETCH_CHART, TAG_PREFETCH);
+  }
+  else {
+    for (int i = 0; i < WATCHLIST_LEN; i++) {
+      if (quoteIsStale(watchlist[i].yf)) fetcher.request(watchlist[i].yf, FETCH_QUOTE, TAG_PREFETCH);
+    }
+  }
+}
+
+// Called on every page change. Draw straight from cache so the page is never blank, then
+// refresh only what's stale and start prefetching for the next page.
+void onPageEnter(int page)
+{
+  pageTimer.page = page;
+  pageTimer.enteredAt = millis();
+  pageTimer.pending = (page == 0 || page == 2);
+  pageTimer.fromCache = false;
+  NexPageScope shown(nexUI, page);
+
+  if (page == 0) {
+    for (int i = 0; i < WATCHLIST_LEN; i++) {
+      if (!watchlist[i].yf->fetchPending && watchlist[i].yf->regularMarketPrice != 0) showQuote(watchlist[i].yf, watchlist[i].field);
+    }
+    if (homeReady()) {
+      pageTimer.fromCache = true;
+      pageDrawn(0);
+    }
+    for (int i = 0; i < WATCHLIST_LEN; i++) {
+      if (quoteIsStale(watchlist[i].yf)) requestHomeQuote(i);
+    }
+    if (homeQuotesPending) nexUI.setText(ui::tStatus, ui::txt, "updating.");
+  }
+  else if (page == 2) {
+    if (!graphSymbol->fetchPending && graphSymbol->minuteDataPoints > 0) {
+      pageTimer.fromCache = true;
+      drawGraph(graphSymbol);
+    }
+    if (chartIsStale(graphSymbol)) fetcher.request(graphSymbol, FETCH_QUOTE_AND_CHART, TAG_GRAPH);
+  }
+
+  prefetchFrom(page);
 }
 
 void trigger0() {
@@ -568,7 +858,7 @@ void trigger16() {
   updateQuotes();
 }
 void trigger17() {
-  updateGraph("ACN");
+  updateGraph(graphSymbol);
 }
 void trigger18() {
   ESP_LOGD("CCD","%s","Update the player info, if possible.");
@@ -586,11 +876,14 @@ unsigned long lastRefresh = 0;
 
 void loop() {
 
-  myNex.NextionListen();
+  // Has to see the Nextion's wake code before NextionListen() eats it, and holds that off
+  // while the code is only partly in.
+  if (power.poll()) myNex.NextionListen();
   if (myNex.currentPageId != myNex.lastCurrentPageId)
   {
     Serial.printf("Cur Page: %d\n", myNex.currentPageId);
     myNex.lastCurrentPageId = myNex.currentPageId;
+    onPageEnter(myNex.currentPageId);
   }
 
   // Do MQTT checks
@@ -600,6 +893,43 @@ void loop() {
   }
   client.loop();
 
+  // Draw anything the fetch workers have finished.
+  FetchJob job;
+  while (fetcher.poll(&job)) {
+    onFetchDone(job);
+    memTelemetry.sample();
+  }
+
+  // Followers do no HTTP at all; they render what the leader publishes.
+  fleet.loop();
+  if (fleet.takeRoleChanged()) {
+    fetcher.pause(!fleet.isLeader());
+    if (fleet.isLeader()) {
+      updateQuotes();
+      updateGraph(graphSymbol);
+    }
+  }
+
+#if USE_QUOTE_STREAM
+  if (fleet.isLeader()) {
+    quoteStream.loop();
+    // Backfill the series with a normal fetch after each (re)connect; ticks take it from there.
+    if (quoteStream.takeReconnected()) {
+      updateQuotes();
+      updateGraph(graphSymbol);
+    }
+  }
+#endif
+  // Nothing gets drawn while the Nextion sleeps. Stream ticks stay dirty until it wakes.
+  // Pages 0 and 2 report back through pageDrawn() once their data is on screen, which may
+  // take a fetch; anything else is done as soon as it's redrawn.
+  if (power.takeWoke()) {
+    onPageEnter(myNex.currentPageId);
+    redrawMedia();
+    if (!pageTimer.pending) power.resumed(myNex.currentPageId);
+  }
+  if (!power.isIdle()) drawStreamedQuotes();
+
   // Refresh every minute when market is open.
   // Also do basic housekeeping every minute.
 
@@ -622,8 +952,12 @@ void loop() {
     {
       ESP_LOGV("CCD","%s","Market Open.");
       // These functions only update page if page is active.
-      updateQuotes();
-      updateGraph("ACN");
+      // The stream keeps everything current while it's up.
+      if (!quoteStream.connected()) {
+        updateQuotes();
+        updateGraph(graphSymbol);
+        prefetchFrom(myNex.currentPageId);
+      }
     }
     else {
       ESP_LOGV("CCD","%s","Market Closed.");
@@ -638,8 +972,20 @@ void loop() {
       updateQuotes();
     }
 
-    // Dim the Nexion overnight. Could probably even shut it down, or tie it into the office lighting.
-    if (timeinfo.tm_hour >= 23 || timeinfo.tm_hour <= 6) {
+    // Telemetry would only wake the radio for nobody.
+    if (!power.isIdle()) {
+      memTelemetry.report(client, "stat/DesktopBuddy/mem");
+      quoteHealth.report(client, "stat/DesktopBuddy/health/quote");
+      chartHealth.report(client, "stat/DesktopBuddy/health/chart");
+      nexUI.report(client, "stat/DesktopBuddy/uart");
+      barStore.report(client, "stat/DesktopBuddy/bars");
+    }
+    barStore.flush(false);
+
+    // Overnight the display sleeps once nobody's touched it for a minute. Woken by a touch it
+    // comes up dim.
+    quietHours = timeinfo.tm_hour >= 23 || timeinfo.tm_hour <= 6;
+    if (quietHours) {
       setNextionBrightness(2);
     }
     else {
@@ -647,4 +993,5 @@ void loop() {
     }
   }
 
+  power.loop(quietHours);
 }
@@ -0,0 +1,119 @@
+#include "Arduino.h"
+#include "EndpointHealth.h"
+
+EndpointHealth::EndpointHealth(const char* name, uint16_t timeoutMs, unsigned long baseBackoffMs, unsigned long maxBackoffMs, int tripAfter)
+{
+  _name = name;
+  _timeoutMs = timeoutMs;
+  _baseBackoffMs = baseBackoffMs;
+  _maxBackoffMs = maxBackoffMs;
+  _tripAfter = tripAfter;
+  _state = CIRCUIT_CLOSED;
+  _consecutive = 0;
+  _opens = 0;
+  _openedAt = 0;
+  _backoffMs = 0;
+  blockedMs = 0;
+  failures = 0;
+  refused = 0;
+  _fetches = 0;
+  _gzipFetches = 0;
+  _sized = 0;
+  _wireBytes = 0;
+  _fetchMs = 0;
+  _maxFetchMs = 0;
+  _mux = portMUX_INITIALIZER_UNLOCKED;
+}
+
+// May a request go out now? While open, the first caller after the backoff gets to probe;
+// everyone else keeps getting refused until that probe reports back.
+bool EndpointHealth::allow()
+{
+  bool ok = true;
+  portENTER_CRITICAL(&_mux);
+  if (_state == CIRCUIT_HALF_OPEN) ok = false;
+  else if (_state == CIRCUIT_OPEN) {
+    if (millis() - _openedAt >= _backoffMs) _state = CIRCUIT_HALF_OPEN;
+    else ok = false;
+  }
+  if (!ok) refused++;
+  portEXIT_CRITICAL(&_mux);
+  return ok;
+}
+
+void EndpointHealth::success()
+{
+  portENTER_CRITICAL(&_mux);
+  bool wasOpen = _state != CIRCUIT_CLOSED;
+  _state = CIRCUIT_CLOSED;
+  _consecutive = 0;
+  _opens = 0;
+  portEXIT_CRITICAL(&_mux);
+  if (wasOpen) ESP_LOGI("CCD", "%s: circuit closed", _name);
+}
+
+void EndpointHealth::failure(unsigned long elapsedMs, int retryAfterSecs)
+{
+  portENTER_CRITICAL(&_mux);
+  blockedMs += elapsedMs;
+  failures++;
+  _consecutive++;
+  bool trip = _state == CIRCUIT_HALF_OPEN || _consecutive >= _tripAfter;
+  if (trip) {
+    unsigned long backoff = _baseBackoffMs << min(_opens, 16);
+    if (backoff > _maxBackoffMs || backoff < _baseBackoffMs) backoff = _maxBackoffMs;
+    backoff += esp_random() % (backoff / 2 + 1);
+    if (retryAfterSecs > 0 && backoff < retryAfterSecs * 1000UL) backoff = retryAfterSecs * 1000UL;
+    _backoffMs = backoff;
+    _openedAt = millis();
+    _state = CIRCUIT_OPEN;
+    _opens++;
+  }
+  unsigned long backoffMs = _backoffMs;
+  portEXIT_CRITICAL(&_mux);
+  if (trip) ESP_LOGE("CCD", "%s: circuit open, retry in %lums", _name, backoffMs);
+}
+
+// The attempt came to nothing for reasons of our own, say no heap. Counts neither way; a
+// probe hands the half-open circuit back so the next caller probes instead.
+void EndpointHealth::release()
+{
+  portENTER_CRITICAL(&_mux);
+  if (_state == CIRCUIT_HALF_OPEN) _state = CIRCUIT_OPEN;
+  portEXIT_CRITICAL(&_mux);
+}
+
+// A body was read. wireBytes is -1 when the server didn't say and it wasn't counted.
+void EndpointHealth::fetched(int wireBytes, bool gzip, unsigned long elapsedMs)
+{
+  portENTER_CRITICAL(&_mux);
+  _fetches++;
+  if (gzip) _gzipFetches++;
+  if (wireBytes >= 0) {
+    _sized++;
+    _wireBytes += wireBytes;
+  }
+  _fetchMs += elapsedMs;
+  if (elapsedMs > _maxFetchMs) _maxFetchMs = elapsedMs;
+  portEXIT_CRITICAL(&_mux);
+}
+
+void EndpointHealth::report(PubSubClient& mqtt, const char* topic)
+{
+  static const char* states[] = { "closed", "open", "half-open" };
+  char msg[256];
+
+  portENTER_CRITICAL(&_mux);
+  CircuitState state = _state;
+  long retryIn = state == CIRCUIT_OPEN ? (long)(_backoffMs - (millis() - _openedAt)) / 1000 : 0;
+  unsigned long fetches = _fetches, gzipFetches = _gzipFetches, maxMs = _maxFetchMs;
+  unsigned long avgBytes = _sized ? _wireBytes / _sized : 0;
+  unsigned long avgMs = _fetches ? _fetchMs / _fetches : 0;
+  _fetches = _gzipFetches = _sized = _wireBytes = _fetchMs = _maxFetchMs = 0;
+  portEXIT_CRITICAL(&_mux);
+
+  snprintf(msg, sizeof(msg), "{\"state\":\"%s\",\"failures\":%lu,\"refused\":%lu,\"blockedMs\":%lu,\"retryInS\":%ld,"
+           "\"fetches\":%lu,\"gzip\":%lu,\"avgBytes\":%lu,\"avgMs\":%lu,\"maxMs\":%lu}",
+           states[state], failures, refused, blockedMs, retryIn, fetches, gzipFetches, avgBytes, avgMs, maxMs);
+  mqtt.publish(topic, msg);
+}
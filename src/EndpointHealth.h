@@ -0,0 +1,62 @@
+#include "Arduino.h"
+#include <PubSubClient.h>
+
+#ifndef EndpointHealth_h
+#define EndpointHealth_h
+
+// Per-endpoint health with a circuit breaker, shared by every YahooFin hitting that endpoint.
+//
+// Closed: requests go out with a tight timeout. After tripAfter failures in a row the
+// circuit opens and requests are refused (callers serve cached data, marked stale) until a
+// backoff expires: base * 2^n, capped, plus up to 50% jitter so a fleet doesn't retry in
+// step. Then one probe goes out (half-open). Success closes the circuit; failure reopens it
+// with the next backoff. A 429 with Retry-After is honoured as a floor.
+//
+// So an outage costs at most tripAfter timeouts, then one timeout per backoff period.
+// blockedMs counts time spent in failed attempts so that bound can be checked.
+//
+// Every attempt that gets past allow() has to end in success(), failure() or release();
+// a half-open circuit stays shut to everyone else until its probe reports back.
+//
+// report() also carries the size and time of the bodies fetched since the last report.
+
+enum CircuitState { CIRCUIT_CLOSED, CIRCUIT_OPEN, CIRCUIT_HALF_OPEN };
+
+class EndpointHealth
+{
+  public:
+    EndpointHealth(const char* name, uint16_t timeoutMs, unsigned long baseBackoffMs, unsigned long maxBackoffMs, int tripAfter);
+    bool allow();
+    void success();
+    void failure(unsigned long elapsedMs, int retryAfterSecs);
+    void release();
+    void fetched(int wireBytes, bool gzip, unsigned long elapsedMs);
+    uint16_t timeoutMs() { return _timeoutMs; }
+    CircuitState state() { return _state; }
+    void report(PubSubClient& mqtt, const char* topic);
+
+    unsigned long blockedMs;   // Total time spent in attempts that failed.
+    unsigned long failures;    // Lifetime count.
+    unsigned long refused;     // Requests turned away while open.
+
+  private:
+    const char* _name;
+    uint16_t _timeoutMs;
+    unsigned long _baseBackoffMs;
+    unsigned long _maxBackoffMs;
+    int _tripAfter;
+    CircuitState _state;
+    int _consecutive;
+    int _opens;                // Backoff exponent; reset on success.
+    unsigned long _openedAt;
+    unsigned long _backoffMs;
+    unsigned long _fetches;    // Since the last report, as are the rest.
+    unsigned long _gzipFetches;
+    unsigned long _sized;      // Fetches whose wire size is known.
+    unsigned long _wireBytes;
+    unsigned long _fetchMs;
+    unsigned long _maxFetchMs;
+    portMUX_TYPE _mux;
+};
+
+#endif
@@ -0,0 +1,137 @@
+#include "Arduino.h"
+#include "GzipStream.h"
+
+// gzip header flags (RFC 1952)
+#define GZ_FHCRC    0x02
+#define GZ_FEXTRA   0x04
+#define GZ_FNAME    0x08
+#define GZ_FCOMMENT 0x10
+
+GzipStream::GzipStream()
+{
+  _src = NULL;
+  wireBytes = 0;
+  inflatedBytes = 0;
+  _decomp = NULL;
+  _dict = NULL;
+  _dictPos = 0;
+  _outStart = 0;
+  _outEnd = 0;
+  _inPos = 0;
+  _inLen = 0;
+  _srcDone = false;
+  _done = false;
+}
+
+GzipStream::~GzipStream()
+{
+  free(_decomp);
+  free(_dict);
+}
+
+// Allocate the window. False if the heap can't spare it; ask for identity instead.
+bool GzipStream::reserve()
+{
+  if (!_decomp) _decomp = (tinfl_decompressor*)malloc(sizeof(tinfl_decompressor));
+  if (!_dict) _dict = (uint8_t*)malloc(TINFL_LZ_DICT_SIZE);
+  if (!_decomp || !_dict) {
+    ESP_LOGW("CCD", "gzip: no heap for the inflate window");
+    return false;
+  }
+  return true;
+}
+
+// Skip the gzip header of the body on src. Call reserve() first. False if the header is bad
+// or the body ends inside it; nothing has been handed to the reader yet, but the header
+// bytes are gone, so the request can't be reused.
+bool GzipStream::begin(WiFiClient& src)
+{
+  _src = &src;
+  if (!_decomp || !_dict) return false;
+  tinfl_init(_decomp);
+
+  if (nextInput() != 0x1f || nextInput() != 0x8b || nextInput() != 8) {
+    ESP_LOGE("CCD", "gzip: bad header");
+    return false;
+  }
+  int flags = nextInput();
+  for (int i = 0; i < 6; i++) nextInput();  // mtime, xfl, os
+
+  if (flags & GZ_FEXTRA) {
+    int len = nextInput();
+    len |= nextInput() << 8;
+    while (len-- > 0) nextInput();
+  }
+  if (flags & GZ_FNAME) while (nextInput() > 0);
+  if (flags & GZ_FCOMMENT) while (nextInput() > 0);
+  if (flags & GZ_FHCRC) {
+    nextInput();
+    nextInput();
+  }
+  return !_srcDone;
+}
+
+// Refill the input buffer from whatever the socket has. Doesn't use readBytes(): with
+// HTTP/1.0 the body ends when the server closes, and readBytes() would sit out the full
+// timeout there on every request.
+int GzipStream::nextInput()
+{
+  if (_inPos < _inLen) return _in[_inPos++];
+
+  unsigned long start = millis();
+  while (!_srcDone) {
+    int n = _src->available();
+    if (n > 0) {
+      _inLen = _src->read(_in, min(n, (int)sizeof(_in)));
+      _inPos = 0;
+      wireBytes += _inLen;
+      return _in[_inPos++];
+    }
+    if (!_src->connected() || millis() - start > (unsigned long)_src->getTimeout()) _srcDone = true;
+    else delay(1);
+  }
+  return -1;
+}
+
+// Inflate until there's output to hand out or the stream is finished.
+bool GzipStream::fill()
+{
+  while (_outStart == _outEnd && !_done) {
+    if (_inPos == _inLen) {
+      int c = nextInput();
+      if (c >= 0) _inPos--;  // Leave it in the buffer for tinfl.
+    }
+
+    size_t inBytes = _inLen - _inPos;
+    size_t outBytes = TINFL_LZ_DICT_SIZE - _dictPos;
+    tinfl_status status = tinfl_decompress(_decomp, _in + _inPos, &inBytes, _dict, _dict + _dictPos, &outBytes,
+                                           _srcDone ? 0 : TINFL_FLAG_HAS_MORE_INPUT);
+    _inPos += inBytes;
+    _outStart = _dictPos;
+    _outEnd = _dictPos + outBytes;
+    _dictPos = (_dictPos + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+    inflatedBytes += outBytes;
+
+    // The 8 byte CRC/size trailer after the last block is left unread; the JSON parser
+    // has already stopped by then.
+    if (status < TINFL_STATUS_DONE) ESP_LOGE("CCD", "gzip: inflate failed, %d", status);
+    if (status <= TINFL_STATUS_DONE) _done = true;
+    if (status == TINFL_STATUS_NEEDS_MORE_INPUT && _srcDone) _done = true;
+  }
+  return _outStart < _outEnd;
+}
+
+int GzipStream::available()
+{
+  return fill() ? _outEnd - _outStart : 0;
+}
+
+int GzipStream::read()
+{
+  return fill() ? _dict[_outStart++] : -1;
+}
+
+int GzipStream::peek()
+{
+  return fill() ? _dict[_outStart] : -1;
+}
@@ -0,0 +1,49 @@
+#include "Arduino.h"
+#include <WiFiClient.h>
+#include "esp32/rom/miniz.h"
+
+#ifndef GzipStream_h
+#define GzipStream_h
+
+// Inflates a gzip HTTP body as it's read, so ArduinoJson can parse it straight off the
+// socket. Uses the tinfl inflater in the ESP32 ROM. Deflate can reach back 32K, so the
+// window has to be the full TINFL_LZ_DICT_SIZE; with the decompressor state that is
+// GZIP_HEAP_NEEDED of heap for the life of the stream.
+//
+// reserve() takes the heap before the request goes out, so a fetch only asks for gzip when
+// it already holds the window. Running short is then never mistaken for a bad response.
+
+#define GZIP_HEAP_NEEDED (TINFL_LZ_DICT_SIZE + sizeof(tinfl_decompressor) + 1024)
+
+class GzipStream : public Stream
+{
+  public:
+    GzipStream();
+    ~GzipStream();
+    bool reserve();
+    bool begin(WiFiClient& src);
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t) override { return 0; }
+    void flush() override {}
+    size_t wireBytes;      // Compressed bytes read off the socket, header included.
+    size_t inflatedBytes;
+
+  private:
+    int nextInput();
+    bool fill();
+    WiFiClient* _src;
+    tinfl_decompressor* _decomp;
+    uint8_t* _dict;
+    size_t _dictPos;
+    size_t _outStart;
+    size_t _outEnd;
+    uint8_t _in[512];
+    size_t _inPos;
+    size_t _inLen;
+    bool _srcDone;
+    bool _done;
+};
+
+#endif
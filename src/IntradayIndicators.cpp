@@ -0,0 +1,111 @@
+#include "IntradayIndicators.h"
+
+IntradayIndicators::IntradayIndicators(int smaPeriod, int emaPeriod)
+{
+  if (smaPeriod < 1) smaPeriod = 1;
+  if (smaPeriod > INDICATOR_MAX_PERIOD) smaPeriod = INDICATOR_MAX_PERIOD;
+  _smaPeriod = smaPeriod;
+  _emaAlpha = 2.0 / (emaPeriod + 1);
+  reset();
+}
+
+void IntradayIndicators::reset()
+{
+  count = 0;
+  _cumPV = 0;
+  _cumVolume = 0;
+  _smaSum = 0;
+  _emaPrev = 0;
+  _lastClose = 0;
+  _lastVolume = 0;
+  _minDone = 0;
+  _maxDone = 0;
+  _minDoneIndex = -1;
+  _maxDoneIndex = -1;
+}
+
+// Start a new bar. The previous one is final from here on.
+void IntradayIndicators::addBar(double close, double volume)
+{
+  if (count >= INDICATOR_MAX_BARS) return;
+
+  if (count > 0) {
+    int done = count - 1;
+    _cumPV += _lastClose * _lastVolume;
+    _cumVolume += _lastVolume;
+    _emaPrev = ema[done];
+    if (_minDoneIndex < 0 || _lastClose < _minDone) {
+      _minDone = _lastClose;
+      _minDoneIndex = done;
+    }
+    if (_maxDoneIndex < 0 || _lastClose >= _maxDone) {
+      _maxDone = _lastClose;
+      _maxDoneIndex = done;
+    }
+  }
+
+  // The window is a ring; once full, the slot we're about to reuse is the bar falling out.
+  int slot = count % _smaPeriod;
+  if (count >= _smaPeriod) _smaSum -= _window[slot];
+  _window[slot] = close;
+  _smaSum += close;
+
+  _lastClose = close;
+  _lastVolume = volume;
+  count++;
+  computeLast();
+}
+
+// Revise the bar still forming, e.g. with a streamed tick.
+void IntradayIndicators::updateLastBar(double close, double volume)
+{
+  if (count == 0) {
+    addBar(close, volume);
+    return;
+  }
+
+  int slot = (count - 1) % _smaPeriod;
+  _smaSum += close - _window[slot];
+  _window[slot] = close;
+
+  _lastClose = close;
+  _lastVolume = volume;
+  computeLast();
+}
+
+void IntradayIndicators::computeLast()
+{
+  int i = count - 1;
+
+  double volume = _cumVolume + _lastVolume;
+  vwap[i] = volume > 0 ? (_cumPV + _lastClose * _lastVolume) / volume : _lastClose;
+
+  int n = count < _smaPeriod ? count : _smaPeriod;
+  sma[i] = _smaSum / n;
+
+  ema[i] = count == 1 ? _lastClose : _emaAlpha * _lastClose + (1 - _emaAlpha) * _emaPrev;
+}
+
+double IntradayIndicators::minClose()
+{
+  if (count == 0) return 0;
+  return (_minDoneIndex < 0 || _lastClose < _minDone) ? _lastClose : _minDone;
+}
+
+double IntradayIndicators::maxClose()
+{
+  if (count == 0) return 0;
+  return (_maxDoneIndex < 0 || _lastClose >= _maxDone) ? _lastClose : _maxDone;
+}
+
+int IntradayIndicators::minIndex()
+{
+  if (count == 0) return -1;
+  return (_minDoneIndex < 0 || _lastClose < _minDone) ? count - 1 : _minDoneIndex;
+}
+
+int IntradayIndicators::maxIndex()
+{
+  if (count == 0) return -1;
+  return (_maxDoneIndex < 0 || _lastClose >= _maxDone) ? count - 1 : _maxDoneIndex;
+}
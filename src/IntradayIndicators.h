@@ -0,0 +1,55 @@
+#include <stdint.h>
+
+#ifndef IntradayIndicators_h
+#define IntradayIndicators_h
+
+// Running indicators over the intraday bar series: VWAP, SMA, EMA and min/max of the close.
+// Everything updates in O(1) per bar, and the current bar can be revised in O(1) as ticks
+// come in, so nothing is ever recomputed over the whole of minuteQuotes.
+//
+// No Arduino dependencies, so it builds and benchmarks on the host as is.
+
+#define INDICATOR_MAX_BARS 195   // Same as MAX_MINUTE_QUOTES.
+#define INDICATOR_MAX_PERIOD 64
+
+class IntradayIndicators
+{
+  public:
+    IntradayIndicators(int smaPeriod, int emaPeriod);
+    void reset();
+    void addBar(double close, double volume);
+    void updateLastBar(double close, double volume);
+
+    int count;
+    // Per-bar values for drawing. Floats: the waveform is 0-255 tall, so precision is moot.
+    float vwap[INDICATOR_MAX_BARS];
+    float sma[INDICATOR_MAX_BARS];
+    float ema[INDICATOR_MAX_BARS];
+
+    double minClose();
+    double maxClose();
+    int minIndex();
+    int maxIndex();
+    bool hasVolume() { return _cumVolume + _lastVolume > 0; }
+
+  private:
+    void computeLast();
+    int _smaPeriod;
+    double _emaAlpha;
+
+    double _cumPV;           // Sum of close * volume, completed bars.
+    double _cumVolume;
+    double _smaSum;          // Sum of the window, completed bars plus the current one.
+    double _window[INDICATOR_MAX_PERIOD];
+    double _emaPrev;         // EMA as of the previous bar.
+
+    double _lastClose;       // The current (possibly still forming) bar.
+    double _lastVolume;
+
+    double _minDone;         // Min/max over completed bars only.
+    double _maxDone;
+    int _minDoneIndex;
+    int _maxDoneIndex;
+};
+
+#endif
@@ -0,0 +1,270 @@
+#include "Arduino.h"
+#include "MemTelemetry.h"
+#include <esp_heap_caps.h>
+
+MemTelemetry memTelemetry;
+
+MemTelemetry::MemTelemetry()
+{
+  _taskCount = 0;
+  minLargestBlock = UINT32_MAX;
+}
+
+void MemTelemetry::watchTask(TaskHandle_t task, const char* name)
+{
+  if (task == NULL || _taskCount >= MEM_MAX_TASKS) return;
+  _tasks[_taskCount] = task;
+  _taskNames[_taskCount] = name;
+  _taskCount++;
+}
+
+// Cheap enough to call after each fetch; catches dips the once-a-minute report would miss.
+void MemTelemetry::sample()
+{
+  uint32_t largest = ESP.getMaxAllocHeap();
+  if (largest < minLargestBlock) minLargestBlock = largest;
+}
+
+#ifdef CCD_MEM_TRACE
+static MemSiteStats sites[MEM_MAX_SITES];
+static int siteCount = 0;
+
+// Which site is active on which task. Tasks get a slot the first time they enter a site.
+static TaskHandle_t slotTask[MEM_MAX_TASKS];
+static int slotSite[MEM_MAX_TASKS];
+static portMUX_TYPE memMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Live allocations made under a site, so each free finds the site to charge. Allocations
+// made outside any site aren't tracked. Open addressing with linear probing.
+struct MemBlock {
+  void* ptr;
+  uint32_t size;
+  int site;
+};
+static MemBlock blocks[MEM_MAX_BLOCKS];
+#endif
+
+void MemTelemetry::report(PubSubClient& mqtt, const char* topic)
+{
+  sample();
+
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint32_t largest = ESP.getMaxAllocHeap();
+  int frag = freeHeap ? 100 - (int)((uint64_t)largest * 100 / freeHeap) : 0;
+
+  char msg[240];
+  int len = snprintf(msg, sizeof(msg), "{\"free\":%u,\"minFree\":%u,\"largest\":%u,\"minLargest\":%u,\"frag\":%d,\"stack\":{",
+                     freeHeap, ESP.getMinFreeHeap(), largest, minLargestBlock, frag);
+  for (int i = 0; i < _taskCount && len < (int)sizeof(msg); i++) {
+    len += snprintf(msg + len, sizeof(msg) - len, "%s\"%s\":%u", i ? "," : "", _taskNames[i],
+                    (unsigned)uxTaskGetStackHighWaterMark(_tasks[i]));
+  }
+  if (len < (int)sizeof(msg)) snprintf(msg + len, sizeof(msg) - len, "}}");
+  mqtt.publish(topic, msg);
+  ESP_LOGI("CCD", "Mem: %s", msg);
+
+#ifdef CCD_MEM_TRACE
+  // One message per site keeps each under PubSubClient's buffer.
+  char siteTopic[64];
+  for (int i = 0; i < siteCount; i++) {
+    MemSiteStats s;
+    portENTER_CRITICAL(&memMux);
+    s = sites[i];
+    portEXIT_CRITICAL(&memMux);
+
+    snprintf(siteTopic, sizeof(siteTopic), "%s/site/%s", topic, s.name);
+    snprintf(msg, sizeof(msg), "{\"allocs\":%u,\"churn\":%u,\"live\":%d,\"peak\":%d,\"untracked\":%u}",
+             s.allocs, s.churnBytes, s.liveBytes, s.peakBytes, s.untracked);
+    mqtt.publish(siteTopic, msg);
+  }
+#endif
+}
+
+#ifdef CCD_MEM_TRACE
+
+static int findSlot(TaskHandle_t task)
+{
+  for (int i = 0; i < MEM_MAX_TASKS; i++) {
+    if (slotTask[i] == task) return i;
+  }
+  return -1;
+}
+
+// Returns the site that was active before, for MemSiteScope to restore.
+int MemTelemetry::enterSite(const char* name)
+{
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  int previous = -1;
+
+  portENTER_CRITICAL(&memMux);
+  int site = -1;
+  for (int i = 0; i < siteCount; i++) {
+    if (!strcmp(sites[i].name, name)) site = i;
+  }
+  if (site < 0 && siteCount < MEM_MAX_SITES) {
+    site = siteCount++;
+    sites[site].name = name;
+  }
+
+  int slot = findSlot(task);
+  if (slot < 0) {
+    slot = findSlot(NULL);
+    if (slot >= 0) {
+      slotTask[slot] = task;
+      slotSite[slot] = -1;
+    }
+  }
+  if (slot >= 0) {
+    previous = slotSite[slot];
+    slotSite[slot] = site;
+  }
+  portEXIT_CRITICAL(&memMux);
+  return previous;
+}
+
+void MemTelemetry::exitSite(int previous)
+{
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  portENTER_CRITICAL(&memMux);
+  int slot = findSlot(task);
+  if (slot >= 0) slotSite[slot] = previous;
+  portEXIT_CRITICAL(&memMux);
+}
+
+static uint32_t blockHash(void* ptr)
+{
+  return ((uint32_t)(uintptr_t)ptr >> 3) * 2654435761u & (MEM_MAX_BLOCKS - 1);
+}
+
+// Call with memMux held.
+static bool blockInsert(void* ptr, uint32_t size, int site)
+{
+  for (uint32_t i = blockHash(ptr), n = 0; n < MEM_MAX_BLOCKS; i = (i + 1) & (MEM_MAX_BLOCKS - 1), n++) {
+    if (blocks[i].ptr == NULL) {
+      blocks[i].ptr = ptr;
+      blocks[i].size = size;
+      blocks[i].site = site;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Call with memMux held. Shifts later entries of the probe run back into the hole, so
+// lookups never need tombstones.
+static bool blockRemove(void* ptr, MemBlock* out)
+{
+  uint32_t i = blockHash(ptr);
+  for (uint32_t n = 0; blocks[i].ptr != ptr; i = (i + 1) & (MEM_MAX_BLOCKS - 1)) {
+    if (blocks[i].ptr == NULL || ++n == MEM_MAX_BLOCKS) return false;
+  }
+  *out = blocks[i];
+  blocks[i].ptr = NULL;
+  for (uint32_t j = (i + 1) & (MEM_MAX_BLOCKS - 1); blocks[j].ptr != NULL; j = (j + 1) & (MEM_MAX_BLOCKS - 1)) {
+    uint32_t home = blockHash(blocks[j].ptr);
+    // Move j into the hole unless its home lies cyclically in (i, j].
+    bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+    if (stays) continue;
+    blocks[i] = blocks[j];
+    blocks[j].ptr = NULL;
+    i = j;
+  }
+  return true;
+}
+
+// Call with memMux held.
+static void charge(int site, void* ptr, uint32_t size)
+{
+  MemSiteStats& s = sites[site];
+  s.allocs++;
+  s.churnBytes += size;
+  if (!blockInsert(ptr, size, site)) {
+    s.untracked++;
+    return;
+  }
+  s.liveBytes += size;
+  if (s.liveBytes > s.peakBytes) s.peakBytes = s.liveBytes;
+}
+
+static int activeSite()
+{
+  TaskHandle_t task = xTaskGetCurrentTaskHandle();
+  if (task == NULL) return -1;
+  int slot = findSlot(task);  // Unlocked read; slots are only ever added.
+  return slot < 0 ? -1 : slotSite[slot];
+}
+
+void MemTelemetry::onAlloc(void* ptr)
+{
+  int site = activeSite();
+  if (site < 0) return;
+  uint32_t size = heap_caps_get_allocated_size(ptr);
+
+  portENTER_CRITICAL_SAFE(&memMux);
+  charge(site, ptr, size);
+  portEXIT_CRITICAL_SAFE(&memMux);
+}
+
+void MemTelemetry::onFree(void* ptr)
+{
+  MemBlock b;
+  portENTER_CRITICAL_SAFE(&memMux);
+  if (blockRemove(ptr, &b)) sites[b.site].liveBytes -= b.size;
+  portEXIT_CRITICAL_SAFE(&memMux);
+}
+
+// A successful realloc stays with the site of the original block. One that wasn't tracked
+// counts as a fresh allocation under the active site.
+void MemTelemetry::onRealloc(void* ptr, void* moved)
+{
+  int active = activeSite();
+  uint32_t size = heap_caps_get_allocated_size(moved);
+  MemBlock b;
+
+  portENTER_CRITICAL_SAFE(&memMux);
+  if (ptr && blockRemove(ptr, &b)) {
+    sites[b.site].liveBytes -= b.size;
+    charge(b.site, moved, size);
+  }
+  else if (active >= 0) charge(active, moved, size);
+  portEXIT_CRITICAL_SAFE(&memMux);
+}
+
+// Linked in with -Wl,--wrap=malloc,--wrap=free,--wrap=realloc,--wrap=calloc.
+extern "C" {
+  void* __real_malloc(size_t size);
+  void __real_free(void* ptr);
+  void* __real_realloc(void* ptr, size_t size);
+  void* __real_calloc(size_t n, size_t size);
+
+  void* __wrap_malloc(size_t size)
+  {
+    void* ptr = __real_malloc(size);
+    if (ptr) MemTelemetry::onAlloc(ptr);
+    return ptr;
+  }
+
+  void __wrap_free(void* ptr)
+  {
+    if (ptr) MemTelemetry::onFree(ptr);
+    __real_free(ptr);
+  }
+
+  void* __wrap_calloc(size_t n, size_t size)
+  {
+    void* ptr = __real_calloc(n, size);
+    if (ptr) MemTelemetry::onAlloc(ptr);
+    return ptr;
+  }
+
+  // A failed realloc leaves the old block as it was; realloc(ptr, 0) frees it.
+  void* __wrap_realloc(void* ptr, size_t size)
+  {
+    if (ptr && size == 0) MemTelemetry::onFree(ptr);
+    void* moved = __real_realloc(ptr, size);
+    if (moved) MemTelemetry::onRealloc(ptr, moved);
+    return moved;
+  }
+}
+
+#endif
@@ -0,0 +1,73 @@
+#include "Arduino.h"
+#include <PubSubClient.h>
+
+#ifndef MemTelemetry_h
+#define MemTelemetry_h
+
+// Heap and stack telemetry, published over MQTT once a minute.
+//
+// Always on: free heap, all-time minimum free heap, largest free block (fragmentation) and
+// the stack high-water mark of every task registered with watchTask().
+//
+// Debug builds (-DCCD_MEM_TRACE plus the malloc --wrap flags, see [env:debug]) also tag
+// every allocation with the call site that is active on the allocating task. Mark a site
+// with MEM_SITE("name") at the top of a function; it stays active until that scope exits.
+// A free is charged back to the site that made the allocation, whichever task frees it.
+
+#define MEM_MAX_TASKS 8
+#define MEM_MAX_SITES 12
+#define MEM_MAX_BLOCKS 512  // Live allocations tracked back to their site. Power of two.
+
+struct MemSiteStats
+{
+  const char* name;
+  uint32_t allocs;      // Number of allocations while the site was active.
+  uint32_t churnBytes;  // Total bytes allocated. Grows forever; diff between reports.
+  int32_t liveBytes;    // Allocated under this site and not yet freed.
+  int32_t peakBytes;    // High-water of liveBytes.
+  uint32_t untracked;   // Allocations that didn't fit the block table; not in liveBytes.
+};
+
+class MemTelemetry
+{
+  public:
+    MemTelemetry();
+    void watchTask(TaskHandle_t task, const char* name);
+    void sample();
+    void report(PubSubClient& mqtt, const char* topic);
+
+    uint32_t minLargestBlock;  // The heap tracks minimum free itself; this it doesn't.
+
+#ifdef CCD_MEM_TRACE
+    static int enterSite(const char* name);
+    static void exitSite(int previous);
+    static void onAlloc(void* ptr);
+    static void onFree(void* ptr);
+    static void onRealloc(void* ptr, void* moved);
+#endif
+
+  private:
+    TaskHandle_t _tasks[MEM_MAX_TASKS];
+    const char* _taskNames[MEM_MAX_TASKS];
+    int _taskCount;
+};
+
+extern MemTelemetry memTelemetry;
+
+#ifdef CCD_MEM_TRACE
+class MemSiteScope
+{
+  public:
+    MemSiteScope(const char* name) { _previous = MemTelemetry::enterSite(name); }
+    ~MemSiteScope() { MemTelemetry::exitSite(_previous); }
+  private:
+    int _previous;
+};
+#define MEM_SITE_CAT2(a, b) a##b
+#define MEM_SITE_CAT(a, b) MEM_SITE_CAT2(a, b)
+#define MEM_SITE(name) MemSiteScope MEM_SITE_CAT(_memSite, __LINE__)(name)
+#else
+#define MEM_SITE(name)
+#endif
+
+#endif
@@ -0,0 +1,95 @@
+#include "Arduino.h"
+#include "NexUI.h"
+
+NexUI::NexUI(Stream& uart) : _uart(uart)
+{
+  sentBytes = 0;
+  savedBytes = 0;
+  shownPage = NEX_PAGE_UNKNOWN;
+}
+
+// "pageN.name.attr", or "name.attr" for NEX_PAGE_ANY and the page in scope. Returns the length.
+int NexUI::address(char* buf, const NexComponent& c, const char* attr)
+{
+  int len = 0;
+  for (const NexPage* p : ui::pages) {
+    if (p->id == c.page && p->id != shownPage) len = sprintf(buf, "%s.", p->name);
+  }
+  if (c.refreshed) savedBytes -= len;
+  len += sprintf(buf + len, "%s.%s", c.name, attr);
+  return len;
+}
+
+void NexUI::send(const char* cmd, int len)
+{
+  _uart.write((const uint8_t*)cmd, len);
+  _uart.write(0xFF);
+  _uart.write(0xFF);
+  _uart.write(0xFF);
+  sentBytes += len + 3;
+}
+
+// Goes out in pieces so a long track title needn't be copied.
+void NexUI::setText(const NexComponent& c, const NexTextAttr& attr, const char* text)
+{
+  char cmd[NEX_CMD_MAX];
+  int len = address(cmd, c, attr.name);
+  cmd[len++] = '=';
+  cmd[len++] = '"';
+  _uart.write((const uint8_t*)cmd, len);
+  int textLen = strlen(text);
+  _uart.write((const uint8_t*)text, textLen);
+  sentBytes += len + textLen;
+  send("\"", 1);
+}
+
+void NexUI::setNum(const NexComponent& c, const NexNumAttr& attr, long value)
+{
+  char cmd[NEX_CMD_MAX];
+  int len = address(cmd, c, attr.name);
+  len += sprintf(cmd + len, "=%ld", value);
+  send(cmd, len);
+}
+
+void NexUI::setColor(const NexComponent& c, const NexNumAttr& attr, const NexColor& color)
+{
+  if (!color.name) {
+    setNum(c, attr, color.value);
+    return;
+  }
+  char cmd[NEX_CMD_MAX];
+  int len = address(cmd, c, attr.name);
+  len += sprintf(cmd + len, "=%s", color.name);
+  savedBytes += nexDigits(color.value) - (int)strlen(color.name);
+  send(cmd, len);
+}
+
+void NexUI::waveClear(uint8_t id, uint8_t channel)
+{
+  char cmd[16];  // "cle 255,255"
+  send(cmd, snprintf(cmd, sizeof(cmd), "cle %u,%u", id, channel));
+}
+
+// Callers keep value to 0-255, but a long is what it takes, so size for the worst of it.
+void NexUI::waveAdd(uint8_t id, uint8_t channel, long value)
+{
+  char cmd[32];  // "add 255,255,-2147483648", or 20 digits with a 64-bit long
+  int len = snprintf(cmd, sizeof(cmd), "add %u,%u,%ld", id, channel, value);
+  send(cmd, min(len, (int)sizeof(cmd) - 1));
+}
+
+void NexUI::command(const char* cmd)
+{
+  send(cmd, strlen(cmd));
+}
+
+// Bytes written since the last report, and how many fewer than the plain form.
+void NexUI::report(PubSubClient& mqtt, const char* topic)
+{
+  char msg[80];
+  sprintf(msg, "{\"sent\":%lu,\"saved\":%ld}", sentBytes, savedBytes);
+  mqtt.publish(topic, msg);
+  sentBytes = 0;
+  savedBytes = 0;
+  shownPage = NEX_PAGE_UNKNOWN;
+}
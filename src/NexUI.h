@@ -0,0 +1,174 @@
+#include "Arduino.h"
+#include <PubSubClient.h>
+
+#ifndef NexUI_h
+#define NexUI_h
+
+// Every page, component, attribute and colour the firmware touches on the Nextion, defined
+// once in the ui namespace below and checked at compile time. NexUI writes through it as
+// pageN.name, which is valid whatever page is showing, and uses a built-in colour name
+// where it's shorter than the number.
+//
+// The page refreshes run right after checking currentPageId, and inside a NexPageScope
+// their writes go out by bare name, as they always have. Nothing else gets the short form:
+// currentPageId is only what EasyNextion last heard, and an MQTT callback can land after
+// a page change it hasn't seen yet, when a bare name hits whatever has it on the new page.
+//
+// savedBytes is against the plain form: colours as numbers, refreshed components bare and
+// everything else qualified. Refreshed components written from outside a scope cost the
+// page prefix, so it can go negative.
+//
+// Must match the HMI. Nothing here can check that; a wrong name is silently ignored by the
+// Nextion (bkcmd=2 does send 0x1A back).
+
+#define NEX_PAGE_ANY -1      // Addressed by bare name from anywhere.
+#define NEX_PAGE_UNKNOWN -2  // No page known to be showing: qualify everything.
+#define NEX_MAX_OBJNAME 14   // Nextion editor limit for page and component names.
+
+struct NexPage { int8_t id; const char* name; };
+struct NexComponent { int8_t page; const char* name; bool refreshed; };  // refreshed: drawn by a page refresh.
+struct NexTextAttr { const char* name; };  // Value goes out quoted.
+struct NexNumAttr { const char* name; };
+struct NexColor { uint16_t value; const char* name; };  // name: built-in constant, if shorter.
+
+// C++11 constexpr, so all of it recursive one-liners.
+constexpr int nexLen(const char* s) { return *s ? 1 + nexLen(s + 1) : 0; }
+constexpr int nexDigits(uint32_t v) { return v < 10 ? 1 : 1 + nexDigits(v / 10); }
+constexpr bool nexStrEq(const char* a, const char* b) { return *a == *b && (*a == 0 || nexStrEq(a + 1, b + 1)); }
+constexpr uint16_t rgb565(uint8_t r, uint8_t g, uint8_t b) { return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3); }
+
+// The Nextion's own colour constants.
+constexpr const char* nexBuiltinColor(uint16_t v)
+{
+  return v == 0 ? "BLACK" : v == 31 ? "BLUE" : v == 2016 ? "GREEN" : v == 33840 ? "GRAY"
+       : v == 48192 ? "BROWN" : v == 63488 ? "RED" : v == 65504 ? "YELLOW" : v == 65535 ? "WHITE" : nullptr;
+}
+constexpr NexColor nexColor(uint16_t v)
+{
+  return { v, nexBuiltinColor(v) && nexLen(nexBuiltinColor(v)) < nexDigits(v) ? nexBuiltinColor(v) : nullptr };
+}
+
+namespace ui {
+
+constexpr NexPage home { 0, "page0" };
+constexpr NexPage graph { 2, "page2" };
+constexpr NexPage media { 3, "page3" };
+constexpr const NexPage* pages[] = { &home, &graph, &media };
+
+// page0: watchlist, status line, office heater.
+constexpr NexComponent tAcn { home.id, "tAcn", true };
+constexpr NexComponent tSP { home.id, "tSP", true };
+constexpr NexComponent tNAS { home.id, "tNAS", true };
+constexpr NexComponent tStatus { home.id, "t7", true };
+constexpr NexComponent bHeat { home.id, "b2" };
+constexpr NexComponent heatState { NEX_PAGE_ANY, "heatState" };
+// page2: quote line and the intraday waveform.
+constexpr NexComponent tQuote { graph.id, "t1", true };
+constexpr NexComponent sGraph { graph.id, "s0", true };
+constexpr uint8_t sGraphId = 2;  // For add/cle, which want the id.
+// page3: Sonos.
+constexpr NexComponent tTrack { media.id, "tTrack" };
+constexpr NexComponent tArtist { media.id, "tArtist" };
+constexpr NexComponent jVolume { media.id, "j1" };
+constexpr NexComponent jProgress { media.id, "j0" };
+constexpr NexComponent tmProgress { media.id, "tm0" };
+constexpr NexComponent bPlayPause { media.id, "bPlayPause" };
+
+constexpr const NexComponent* components[] = {
+  &tAcn, &tSP, &tNAS, &tStatus, &bHeat, &heatState,
+  &tQuote, &sGraph,
+  &tTrack, &tArtist, &jVolume, &jProgress, &tmProgress, &bPlayPause,
+};
+
+constexpr NexTextAttr txt { "txt" };
+constexpr NexNumAttr val { "val" };
+constexpr NexNumAttr pco { "pco" };
+constexpr NexNumAttr pco0 { "pco0" };  // Waveform channel 0.
+constexpr NexNumAttr pic { "pic" };
+constexpr NexNumAttr en { "en" };
+constexpr NexNumAttr tim { "tim" };
+
+constexpr NexColor up = nexColor(rgb565(128, 252, 0));      // 34784
+constexpr NexColor down = nexColor(rgb565(255, 0, 0));      // 63488, RED
+constexpr NexColor flat = nexColor(rgb565(255, 255, 255));  // 65535
+constexpr NexColor stale = nexColor(rgb565(128, 128, 128)); // 33808, not quite GRAY
+constexpr NexColor label = nexColor(rgb565(224, 224, 224)); // 59164, graph annotations
+
+constexpr int picHeatOff = 19;
+constexpr int picHeatOn = 33;
+constexpr int picPause = 9;
+constexpr int picPlay = 10;
+
+}  // namespace ui
+
+// Compile-time checks over the tables above.
+constexpr bool nexPageKnown(int8_t id, int i = 0)
+{
+  return id == NEX_PAGE_ANY || (i < (int)(sizeof(ui::pages) / sizeof(ui::pages[0])) && (ui::pages[i]->id == id || nexPageKnown(id, i + 1)));
+}
+constexpr bool nexPagesOk(int i = 0)
+{
+  return i >= (int)(sizeof(ui::pages) / sizeof(ui::pages[0]))
+      || (nexLen(ui::pages[i]->name) <= NEX_MAX_OBJNAME && nexPagesOk(i + 1));
+}
+// Two components clash if they share a name and either could be addressed from the same page.
+constexpr bool nexClash(const NexComponent* a, const NexComponent* b)
+{
+  return a != b && nexStrEq(a->name, b->name) && (a->page == b->page || a->page == NEX_PAGE_ANY || b->page == NEX_PAGE_ANY);
+}
+constexpr bool nexUniqueFrom(const NexComponent* c, int i = 0)
+{
+  return i >= (int)(sizeof(ui::components) / sizeof(ui::components[0])) || (!nexClash(c, ui::components[i]) && nexUniqueFrom(c, i + 1));
+}
+constexpr bool nexComponentsOk(int i = 0)
+{
+  return i >= (int)(sizeof(ui::components) / sizeof(ui::components[0]))
+      || (nexLen(ui::components[i]->name) <= NEX_MAX_OBJNAME
+          && nexPageKnown(ui::components[i]->page)
+          && nexUniqueFrom(ui::components[i])
+          && nexComponentsOk(i + 1));
+}
+static_assert(nexPagesOk(), "Nextion page name too long");
+static_assert(nexComponentsOk(), "Nextion component name too long, on an unknown page, or not unique");
+static_assert(ui::up.value != ui::down.value && ui::stale.value != ui::up.value && ui::stale.value != ui::down.value && ui::stale.value != ui::flat.value,
+              "Palette entries must be told apart on screen");
+
+// Longest fully qualified "pageN.name.attr=" plus a number, for the command buffer.
+#define NEX_CMD_MAX (2 * NEX_MAX_OBJNAME + 8 + 12)
+
+class NexUI
+{
+  public:
+    NexUI(Stream& uart);
+    void setText(const NexComponent& c, const NexTextAttr& attr, const char* text);
+    void setNum(const NexComponent& c, const NexNumAttr& attr, long value);
+    void setColor(const NexComponent& c, const NexNumAttr& attr, const NexColor& color);
+    void waveClear(uint8_t id, uint8_t channel);
+    void waveAdd(uint8_t id, uint8_t channel, long value);
+    void command(const char* cmd);
+    void report(PubSubClient& mqtt, const char* topic);
+
+    unsigned long sentBytes;   // Since the last report.
+    long savedBytes;           // Against the plain form; see above.
+    int8_t shownPage;          // Set by NexPageScope.
+
+  private:
+    int address(char* buf, const NexComponent& c, const char* attr);
+    void send(const char* cmd, int len);
+    Stream& _uart;
+};
+
+// Components on `page` go out by bare name while this is in scope. Only for code that has
+// just checked currentPageId; pass it that.
+class NexPageScope
+{
+  public:
+    NexPageScope(NexUI& ui, int page) : _ui(ui), _prev(ui.shownPage) { ui.shownPage = page; }
+    ~NexPageScope() { _ui.shownPage = _prev; }
+
+  private:
+    NexUI& _ui;
+    int8_t _prev;
+};
+
+#endif
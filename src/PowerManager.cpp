@@ -0,0 +1,180 @@
+#include "Arduino.h"
+#include "PowerManager.h"
+#include <WiFi.h>
+#include <esp_wifi.h>
+
+#define NEX_AUTO_SLEEP 0x86
+#define NEX_AUTO_WAKE 0x87
+
+static const char* wakeSources[] = { "touch", "mqtt", "schedule" };
+
+PowerManager::PowerManager(EasyNex& nex, HardwareSerial& uart, PubSubClient& mqtt) : _nex(nex), _uart(uart), _mqtt(mqtt)
+{
+  _idle = false;
+  _forced = false;
+  _woke = false;
+  _resuming = false;
+  _wakeSource = POWER_WAKE_SCHEDULE;
+  _lastActivity = 0;
+  _lastPoll = 0;
+  _idleSince = 0;
+  _wakeAt = 0;
+  _detectMs = 0;
+}
+
+// After WiFi is up and before the MQTT connect.
+void PowerManager::begin()
+{
+  // Sleeping is our call, not the Nextion's timer. A touch wakes it.
+  _nex.writeStr("thsp=0");
+  _nex.writeStr("thup=1");
+
+  // IDF picks up the listen interval at the next association; until then max modem
+  // sleep wakes on DTIM, which is merely less frugal.
+  wifi_config_t conf;
+  if (esp_wifi_get_config(WIFI_IF_STA, &conf) == ESP_OK) {
+    conf.sta.listen_interval = POWER_LISTEN_INTERVAL;
+    esp_wifi_set_config(WIFI_IF_STA, &conf);
+  }
+  _lastActivity = millis();
+}
+
+// Right before every MQTT connect, so the broker gives us the idle keepalive's grace.
+void PowerManager::beforeConnect()
+{
+  _mqtt.setKeepAlive(POWER_MQTT_KEEPALIVE_SECS);
+}
+
+void PowerManager::onConnect()
+{
+  if (!_idle) _mqtt.setKeepAlive(POWER_MQTT_AWAKE_KEEPALIVE_SECS);
+  _mqtt.subscribe(POWER_CMD_TOPIC);
+}
+
+bool PowerManager::handleMessage(char* topic, byte* payload, unsigned int length)
+{
+  if (strcmp(topic, POWER_CMD_TOPIC)) return false;
+  if (length >= 4 && !strncmp((char*)payload, "wake", 4)) wake(POWER_WAKE_MQTT);
+  else if (length >= 5 && !strncmp((char*)payload, "sleep", 5)) sleep(true);
+  return true;
+}
+
+// Call before NextionListen(), and skip that if this returns false. Anything else from
+// the Nextion is a touch event, so it counts as activity and is left for EasyNextion.
+bool PowerManager::poll()
+{
+  unsigned long now = millis();
+  unsigned long gap = now - _lastPoll;
+  _lastPoll = now;
+
+  if (!_uart.available()) return true;
+  int c = _uart.peek();
+  if (c == NEX_AUTO_WAKE || c == NEX_AUTO_SLEEP) {
+    // Rest of the 0xFF terminator next pass. Until then NextionListen() would read the
+    // code as a stray byte and drop it.
+    if (_uart.available() < 4) return false;
+    for (int i = 0; i < 4; i++) _uart.read();
+    if (c == NEX_AUTO_SLEEP) {
+      ESP_LOGI("CCD", "Power: Nextion went to sleep on its own");
+      return true;
+    }
+    _detectMs = gap;
+    wake(POWER_WAKE_TOUCH);
+    return true;
+  }
+  activity();
+  if (_idle) {
+    _detectMs = gap;
+    wake(POWER_WAKE_TOUCH);
+  }
+  return true;
+}
+
+// Call at the end of loop(). idleWindow is whether it's the time of day to be sleeping.
+void PowerManager::loop(bool idleWindow)
+{
+  if (_resuming && millis() - _wakeAt > POWER_RESUME_GIVEUP_MS) {
+    ESP_LOGW("CCD", "Power: page not drawn %lums after waking", millis() - _wakeAt);
+    _resuming = false;
+  }
+  if (!_idle) {
+    if (idleWindow && millis() - _lastActivity > POWER_IDLE_AFTER_MS) sleep(false);
+    return;
+  }
+  if (!idleWindow && !_forced) {
+    _detectMs = 0;
+    wake(POWER_WAKE_SCHEDULE);
+    return;
+  }
+  delay(POWER_IDLE_LOOP_MS);  // Lets the idle task wait for an interrupt.
+}
+
+void PowerManager::activity()
+{
+  _lastActivity = millis();
+}
+
+void PowerManager::sleep(bool forced)
+{
+  _forced = forced;
+  if (_idle) return;
+
+  _nex.writeStr("sleep=1");
+  _uart.flush();
+  _mqtt.setKeepAlive(POWER_MQTT_KEEPALIVE_SECS);
+  _resuming = false;
+  WiFi.setSleep(WIFI_PS_MAX_MODEM);
+  setCpuFrequencyMhz(POWER_IDLE_CPU_MHZ);
+  _idle = true;
+  _idleSince = millis();
+
+  char msg[64];
+  sprintf(msg, "{\"state\":\"idle\",\"forced\":%s}", forced ? "true" : "false");
+  publish(msg);
+}
+
+// Everything that makes us fast comes back first; the redraw is the caller's, once
+// takeWoke() says so, and resumed() closes the measurement once the page is drawn.
+void PowerManager::wake(PowerWakeSource source)
+{
+  activity();
+  if (!_idle) return;
+
+  _wakeAt = millis();
+  setCpuFrequencyMhz(POWER_AWAKE_CPU_MHZ);
+  WiFi.setSleep(WIFI_PS_MIN_MODEM);
+  _mqtt.setKeepAlive(POWER_MQTT_AWAKE_KEEPALIVE_SECS);
+  if (source != POWER_WAKE_TOUCH) _nex.writeStr("sleep=0");
+  _idle = false;
+  _forced = false;
+  _woke = true;
+  _resuming = true;
+  _wakeSource = source;
+}
+
+bool PowerManager::takeWoke()
+{
+  bool woke = _woke;
+  _woke = false;
+  return woke;
+}
+
+// The page on screen has been drawn since the wake.
+void PowerManager::resumed(int page)
+{
+  if (!_resuming) return;
+  _resuming = false;
+  _uart.flush();
+  unsigned long resumeMs = millis() - _wakeAt;
+
+  char msg[144];
+  snprintf(msg, sizeof(msg), "{\"state\":\"awake\",\"source\":\"%s\",\"page\":%d,\"resumeMs\":%lu,\"detectMs\":%lu,\"idleS\":%lu}",
+           wakeSources[_wakeSource], page, resumeMs, _detectMs, (_wakeAt - _idleSince) / 1000);
+  ESP_LOGI("CCD", "Power: %s", msg);
+  publish(msg);
+}
+
+void PowerManager::publish(const char* msg)
+{
+  if (_mqtt.connected()) _mqtt.publish(POWER_STAT_TOPIC, msg);
+}
@@ -0,0 +1,77 @@
+#include "Arduino.h"
+#include <PubSubClient.h>
+#include <EasyNextionLibrary.h>
+
+#ifndef PowerManager_h
+#define PowerManager_h
+
+// Low-power idle for the quiet hours. While idle the Nextion is asleep (backlight off, touch
+// still live), the radio is in max modem sleep, the CPU is clocked down and loop() naps
+// between passes. A touch, a command on POWER_CMD_TOPIC or the player starting up wakes it.
+//
+// The Nextion wakes itself on touch (thup=1) and sends 0x87. EasyNextion throws away
+// anything that isn't its own '#' framing, so poll() has to look before NextionListen(),
+// and says whether NextionListen() may run: not while half a 0x87 frame is in the buffer.
+//
+// Every transition goes to POWER_STAT_TOPIC. On wake that includes resumeMs, the time from
+// noticing the wake to the page being drawn (fetches included, for a page that waits on
+// them) and flushed out of the UART, and detectMs, an upper bound on how long the 0x87
+// could have sat in the buffer. Current can't be read from here; put a meter inline and
+// line it up with the published transitions.
+
+#define POWER_CMD_TOPIC "cmnd/DesktopBuddy/power"   // "wake" or "sleep"
+#define POWER_STAT_TOPIC "stat/DesktopBuddy/power"
+#define POWER_IDLE_AFTER_MS 60000  // Quiet this long within the idle window before sleeping.
+#define POWER_IDLE_LOOP_MS 20      // Nap per pass while idle. Bounds touch detection.
+#define POWER_IDLE_CPU_MHZ 80      // Lowest that keeps the APB, and so the UART baud, and WiFi.
+#define POWER_AWAKE_CPU_MHZ 240
+
+// In max modem sleep the station only wakes for every POWER_LISTEN_INTERVAL'th beacon. Keep
+// it a multiple of the AP's DTIM period (1 or 3 on most APs) so buffered broadcast traffic
+// isn't missed: 3 beacons is about 300ms. While idle the MQTT keepalive is stretched to a
+// minute, so the one ping goes out alongside the housekeeping publishes rather than every
+// 15s, and the broker's 1.5x grace dwarfs the few hundred ms a packet can wait for the
+// radio. The broker only learns the keepalive at connect, so the minute is what's always
+// negotiated (beforeConnect()); awake, the client just pings at the usual 15s.
+#define POWER_LISTEN_INTERVAL 3
+#define POWER_MQTT_KEEPALIVE_SECS 60
+#define POWER_MQTT_AWAKE_KEEPALIVE_SECS MQTT_KEEPALIVE
+#define POWER_RESUME_GIVEUP_MS 30000  // Stop waiting for the page to draw after a wake.
+
+enum PowerWakeSource { POWER_WAKE_TOUCH, POWER_WAKE_MQTT, POWER_WAKE_SCHEDULE };
+
+class PowerManager
+{
+  public:
+    PowerManager(EasyNex& nex, HardwareSerial& uart, PubSubClient& mqtt);
+    void begin();
+    void beforeConnect();
+    void onConnect();
+    bool handleMessage(char* topic, byte* payload, unsigned int length);
+    bool poll();
+    void loop(bool idleWindow);
+    void activity();
+    void sleep(bool forced);
+    void wake(PowerWakeSource source);
+    bool isIdle() { return _idle; }
+    bool takeWoke();
+    void resumed(int page);
+
+  private:
+    void publish(const char* msg);
+    EasyNex& _nex;
+    HardwareSerial& _uart;
+    PubSubClient& _mqtt;
+    bool _idle;
+    bool _forced;          // Slept on command; only a touch or "wake" ends it.
+    bool _woke;
+    bool _resuming;        // Woke, and the page isn't drawn yet.
+    PowerWakeSource _wakeSource;
+    unsigned long _lastActivity;
+    unsigned long _lastPoll;
+    unsigned long _idleSince;
+    unsigned long _wakeAt;
+    unsigned long _detectMs;
+};
+
+#endif
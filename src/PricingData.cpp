@@ -0,0 +1,116 @@
+#include <string.h>
+#include "PricingData.h"
+
+// PricingData field numbers we care about. The rest are skipped.
+#define PD_ID             1   // string
+#define PD_PRICE          2   // float
+#define PD_TIME           3   // sint64, ms since epoch
+#define PD_DAY_HIGH       10  // float
+#define PD_DAY_LOW        11  // float
+#define PD_PREVIOUS_CLOSE 16  // float
+
+static int base64Value(char c)
+{
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+// Standard alphabet, padding optional. False on anything else, or if out is too small.
+bool base64Decode(const char* in, size_t len, uint8_t* out, size_t outSize, size_t* outLen)
+{
+  for (int pad = 0; pad < 2 && len > 0 && in[len - 1] == '='; pad++) len--;
+  if (len % 4 == 1) return false;
+
+  uint32_t acc = 0;
+  int bits = 0;
+  size_t n = 0;
+  for (size_t i = 0; i < len; i++) {
+    int v = base64Value(in[i]);
+    if (v < 0) return false;
+    acc = (acc << 6) | v;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      if (n >= outSize) return false;
+      out[n++] = (uint8_t)(acc >> bits);
+    }
+  }
+  *outLen = n;
+  return true;
+}
+
+static bool readVarint(const uint8_t* buf, size_t len, size_t* pos, uint64_t* out)
+{
+  uint64_t v = 0;
+  for (int shift = 0; shift < 64 && *pos < len; shift += 7) {
+    uint8_t b = buf[(*pos)++];
+    v |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      *out = v;
+      return true;
+    }
+  }
+  return false;
+}
+
+static float readFloat(const uint8_t* p)
+{
+  float f;
+  memcpy(&f, p, sizeof(f));  // Protobuf fixed32 is little-endian, same as the ESP32.
+  return f;
+}
+
+// False if the message is cut short or uses a wire type protobuf doesn't have.
+bool decodePricing(const uint8_t* buf, size_t len, PricingTick* tick)
+{
+  memset(tick, 0, sizeof(*tick));
+
+  size_t pos = 0;
+  while (pos < len) {
+    uint64_t key, v;
+    if (!readVarint(buf, len, &pos, &key)) return false;
+    int field = key >> 3;
+
+    switch (key & 7) {
+      case 0:  // varint
+        if (!readVarint(buf, len, &pos, &v)) return false;
+        if (field == PD_TIME) tick->timeMs = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);  // zigzag
+        break;
+      case 1:  // fixed64
+        if (len - pos < 8) return false;
+        pos += 8;
+        break;
+      case 2:  // length-delimited
+        if (!readVarint(buf, len, &pos, &v) || v > len - pos) return false;
+        if (field == PD_ID) {
+          size_t n = v < sizeof(tick->id) - 1 ? (size_t)v : sizeof(tick->id) - 1;
+          memcpy(tick->id, buf + pos, n);
+          tick->id[n] = 0;
+        }
+        pos += v;
+        break;
+      case 5:  // fixed32
+        if (len - pos < 4) return false;
+        if (field == PD_PRICE) tick->price = readFloat(buf + pos);
+        else if (field == PD_DAY_HIGH) tick->dayHigh = readFloat(buf + pos);
+        else if (field == PD_DAY_LOW) tick->dayLow = readFloat(buf + pos);
+        else if (field == PD_PREVIOUS_CLOSE) tick->previousClose = readFloat(buf + pos);
+        pos += 4;
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+bool decodePricingBase64(const char* b64, size_t len, PricingTick* tick)
+{
+  uint8_t buf[PRICING_MAX_BYTES];
+  size_t n;
+  return base64Decode(b64, len, buf, sizeof(buf), &n) && decodePricing(buf, n, tick);
+}
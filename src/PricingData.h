@@ -0,0 +1,28 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef PricingData_h
+#define PricingData_h
+
+// Decodes the Yahoo streamer's PricingData message: base64 text carrying a protobuf. Only
+// the fields the display uses are kept; the rest are skipped by wire type.
+//
+// No Arduino dependencies, so it's unit tested on the host (test/test_pricing).
+
+#define PRICING_MAX_BYTES 256   // Decoded message. Real ones run to about 130.
+
+struct PricingTick
+{
+  char id[16];           // Symbol, truncated to fit.
+  double price;
+  double dayHigh;        // 0 when not in this message, as for the rest.
+  double dayLow;
+  double previousClose;
+  int64_t timeMs;        // Since the epoch.
+};
+
+bool decodePricing(const uint8_t* buf, size_t len, PricingTick* tick);
+bool decodePricingBase64(const char* b64, size_t len, PricingTick* tick);
+bool base64Decode(const char* in, size_t len, uint8_t* out, size_t outSize, size_t* outLen);
+
+#endif
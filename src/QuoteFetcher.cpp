@@ -0,0 +1,88 @@
+#include "Arduino.h"
+#include "QuoteFetcher.h"
+
+#define FETCH_QUEUE_LEN 16
+#define FETCH_TASK_STACK 10240  // TLS handshake + HTTPClient. JSON docs live on the heap.
+
+QuoteFetcher::QuoteFetcher(int maxInFlight, uint16_t deadlineMs)
+{
+  _maxInFlight = min(maxInFlight, FETCH_MAX_WORKERS);
+  _deadlineMs = deadlineMs;
+  _paused = false;
+  _todo = NULL;
+  _done = NULL;
+}
+
+void QuoteFetcher::begin()
+{
+  _todo = xQueueCreate(FETCH_QUEUE_LEN, sizeof(FetchJob));
+  _done = xQueueCreate(FETCH_QUEUE_LEN, sizeof(FetchJob));
+
+  for (int i = 0; i < _maxInFlight; i++) {
+    char name[12];
+    sprintf(name, "fetch%d", i);
+    // Core 0 alongside the WiFi stack, leaving core 1 to loop() and the display.
+    xTaskCreatePinnedToCore(worker, name, FETCH_TASK_STACK, this, 1, &_tasks[i], 0);
+  }
+  ESP_LOGI("CCD", "QuoteFetcher started. %d workers, %dms deadline", _maxInFlight, _deadlineMs);
+}
+
+// Queue a fetch. Returns false if this symbol is already being fetched, the queue is full,
+// or fetching is paused. Only call from loop(); fetchPending is never touched by the workers.
+bool QuoteFetcher::request(YahooFin* yf, FetchKind kind, int tag)
+{
+  if (_paused || yf->fetchPending) return false;
+
+  FetchJob job;
+  job.yf = yf;
+  job.kind = kind;
+  job.tag = tag;
+  job.queuedAt = millis();
+  job.deadline = job.queuedAt + _deadlineMs;
+  job.finishedAt = 0;
+  job.ok = false;
+  job.late = false;
+
+  if (xQueueSend(_todo, &job, 0) != pdTRUE) {
+    ESP_LOGE("CCD", "Fetch queue full, dropping %s", yf->getSymbol());
+    return false;
+  }
+  yf->fetchPending = true;
+  return true;
+}
+
+// Hand back one finished job, if any. Never blocks. The YahooFin is safe to read once it
+// comes back through here.
+bool QuoteFetcher::poll(FetchJob* job)
+{
+  if (xQueueReceive(_done, job, 0) != pdTRUE) return false;
+
+  job->yf->fetchPending = false;
+  job->late = (long)(job->finishedAt - job->deadline) > 0;
+  if (job->late) ESP_LOGE("CCD", "Fetch for %s missed its deadline by %lums", job->yf->getSymbol(), job->finishedAt - job->deadline);
+  ESP_LOGD("CCD", "Fetch %s done in %lums", job->yf->getSymbol(), job->finishedAt - job->queuedAt);
+  return true;
+}
+
+void QuoteFetcher::worker(void* arg)
+{
+  QuoteFetcher* self = (QuoteFetcher*)arg;
+  FetchJob job;
+
+  for (;;) {
+    if (xQueueReceive(self->_todo, &job, portMAX_DELAY) != pdTRUE) continue;
+
+    // Whatever is left of the deadline becomes the HTTP timeout, so a stuck request
+    // can't hold a worker much past it.
+    long remaining = (long)(job.deadline - millis());
+    if (remaining < 500) remaining = 500;
+    job.yf->setTimeout(remaining);
+
+    job.ok = true;
+    if (job.kind == FETCH_QUOTE || job.kind == FETCH_QUOTE_AND_CHART) job.ok = job.yf->getQuote();
+    if (job.ok && (job.kind == FETCH_CHART || job.kind == FETCH_QUOTE_AND_CHART)) job.ok = job.yf->getChart();
+    job.finishedAt = millis();
+
+    xQueueSend(self->_done, &job, portMAX_DELAY);
+  }
+}
@@ -0,0 +1,47 @@
+#include "Arduino.h"
+#include "YahooFin.h"
+
+#ifndef QuoteFetcher_h
+#define QuoteFetcher_h
+
+#define FETCH_MAX_WORKERS 8
+
+// Runs YahooFin fetches on a small pool of worker tasks so several symbols are in flight
+// at once and loop() never blocks on the network. The pool size is the concurrency limit;
+// each TLS session costs ~40K of heap, so don't go wild.
+
+enum FetchKind { FETCH_QUOTE, FETCH_CHART, FETCH_QUOTE_AND_CHART };
+
+struct FetchJob
+{
+  YahooFin* yf;
+  FetchKind kind;
+  int tag;                  // Caller's id, handed back untouched on completion.
+  unsigned long queuedAt;   // millis()
+  unsigned long deadline;   // millis() after which the result counts as late.
+  unsigned long finishedAt;
+  bool ok;                  // The fetch's own result; the YahooFin holds the new data if set.
+  bool late;                // Finished past the deadline. Still good data, just slow.
+};
+
+class QuoteFetcher
+{
+  public:
+    QuoteFetcher(int maxInFlight, uint16_t deadlineMs);
+    void begin();
+    bool request(YahooFin* yf, FetchKind kind, int tag);
+    bool poll(FetchJob* job);
+    void pause(bool paused) { _paused = paused; }
+    TaskHandle_t getTask(int i) { return (i >= 0 && i < _maxInFlight) ? _tasks[i] : NULL; }
+
+  private:
+    static void worker(void* arg);
+    QueueHandle_t _todo;
+    QueueHandle_t _done;
+    TaskHandle_t _tasks[FETCH_MAX_WORKERS];
+    int _maxInFlight;
+    uint16_t _deadlineMs;
+    bool _paused;
+};
+
+#endif
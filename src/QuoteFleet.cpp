@@ -0,0 +1,244 @@
+#include "Arduino.h"
+#include "QuoteFleet.h"
+#include <WiFi.h>
+
+QuoteFleet::QuoteFleet(PubSubClient& mqtt, FleetRole role) : _mqtt(mqtt)
+{
+  _role = role;
+  _clientId[0] = 0;
+  _leader = false;
+  _roleChanged = true;
+  _electing = false;
+  _connectedAt = 0;
+  _lockSeenAt = 0;
+  _heartbeatAt = 0;
+  _count = 0;
+}
+
+void QuoteFleet::add(YahooFin* yf)
+{
+  if (_count >= FLEET_MAX_SYMBOLS) return;
+  _symbols[_count] = yf;
+  _dirty[_count] = false;
+  _count++;
+}
+
+// Every unit needs its own MQTT client id or the broker keeps kicking one off for the other.
+const char* QuoteFleet::clientId()
+{
+  if (!_clientId[0]) {
+    uint8_t mac[6];
+    WiFi.macAddress(mac);
+    sprintf(_clientId, "DesktopBuddy-%02X%02X%02X", mac[3], mac[4], mac[5]);
+  }
+  return _clientId;
+}
+
+void QuoteFleet::onConnect()
+{
+  _mqtt.subscribe(FLEET_LOCK_TOPIC);
+  _mqtt.subscribe(FLEET_QUOTE_TOPIC "#");
+  _mqtt.subscribe(FLEET_SERIES_TOPIC "#");
+
+  if (_role == FLEET_LEADER) claim();
+  else if (_role == FLEET_FOLLOWER) setLeader(false);
+  else {
+    _electing = true;
+    _connectedAt = millis();
+    _lockSeenAt = 0;
+  }
+}
+
+void QuoteFleet::loop()
+{
+  if (!_mqtt.connected()) return;
+
+  if (_electing && millis() - _connectedAt > FLEET_ELECTION_MS) {
+    _electing = false;
+    if (_lockSeenAt == 0) claim();
+  }
+
+  if (_leader && millis() - _heartbeatAt > FLEET_HEARTBEAT_SECS * 1000UL) claim();
+
+  // The leader has gone quiet. Take over.
+  if (_role != FLEET_FOLLOWER && !_leader && !_electing && millis() - _lockSeenAt > FLEET_LOCK_STALE_SECS * 1000UL) {
+    ESP_LOGI("CCD", "Fleet: leader lock is stale, taking over");
+    claim();
+  }
+}
+
+void QuoteFleet::claim()
+{
+  char lock[48];
+  sprintf(lock, "%s %lu%s", clientId(), (unsigned long)time(NULL), _role == FLEET_LEADER ? " pinned" : "");
+  _mqtt.publish(FLEET_LOCK_TOPIC, lock, true);
+  _heartbeatAt = millis();
+  setLeader(true);
+}
+
+void QuoteFleet::setLeader(bool leader)
+{
+  if (leader != _leader) {
+    ESP_LOGI("CCD", "Fleet: %s is now %s", clientId(), leader ? "leader" : "follower");
+    _roleChanged = true;
+  }
+  _leader = leader;
+}
+
+// True once after each change of role, and once at start.
+bool QuoteFleet::takeRoleChanged()
+{
+  bool changed = _roleChanged;
+  _roleChanged = false;
+  return changed;
+}
+
+bool QuoteFleet::takeDirty(YahooFin* yf)
+{
+  for (int i = 0; i < _count; i++) {
+    if (_symbols[i] == yf) {
+      bool dirty = _dirty[i];
+      _dirty[i] = false;
+      return dirty;
+    }
+  }
+  return false;
+}
+
+int QuoteFleet::find(const char* symbol)
+{
+  for (int i = 0; i < _count; i++) {
+    if (!strcmp(symbol, _symbols[i]->getSymbol())) return i;
+  }
+  return -1;
+}
+
+void QuoteFleet::publishQuote(YahooFin* yf)
+{
+  if (!_leader) return;
+
+  FleetQuote q;
+  q.version = FLEET_SNAPSHOT_VERSION;
+  q.flags = yf->quoteStale ? FLEET_STALE : 0;
+  q.updated = yf->lastUpdateTime;
+  q.price = yf->regularMarketPrice;
+  q.dayHigh = yf->regularMarketDayHigh;
+  q.dayLow = yf->regularMarketDayLow;
+  q.previousClose = yf->regularMarketPreviousClose;
+
+  char topic[48];
+  sprintf(topic, FLEET_QUOTE_TOPIC "%s", yf->getSymbol());
+  _mqtt.publish(topic, (const uint8_t*)&q, sizeof(q), true);
+}
+
+void QuoteFleet::publishSeries(YahooFin* yf)
+{
+  if (!_leader) return;
+
+  // ~1.2KB for a full day. MQTT_BUFFER_SIZE has to cover it.
+  uint8_t buf[sizeof(FleetSeriesHeader) + MAX_MINUTE_QUOTES * sizeof(FleetSeriesBar)];
+  FleetSeriesHeader h;
+  h.version = FLEET_SNAPSHOT_VERSION;
+  h.flags = yf->chartStale ? FLEET_STALE : 0;
+  h.count = yf->minuteDataPoints;
+  h.firstBarTime = yf->firstBarTime;
+  memcpy(buf, &h, sizeof(h));
+  for (int i = 0; i < yf->minuteDataPoints; i++) {
+    FleetSeriesBar b;
+    b.slot = (yf->minuteTimes[i] - yf->firstBarTime) / CHART_INTERVAL_SECS;
+    b.close = yf->minuteQuotes[i];
+    memcpy(buf + sizeof(h) + i * sizeof(b), &b, sizeof(b));
+  }
+
+  char topic[48];
+  sprintf(topic, FLEET_SERIES_TOPIC "%s", yf->getSymbol());
+  if (!_mqtt.publish(topic, buf, sizeof(h) + h.count * sizeof(FleetSeriesBar), true)) {
+    ESP_LOGE("CCD", "Fleet: series for %s didn't fit the MQTT buffer", yf->getSymbol());
+  }
+}
+
+// Returns true if the message was a fleet message, whether or not it was used.
+bool QuoteFleet::handleMessage(char* topic, byte* payload, unsigned int length)
+{
+  if (!strcmp(topic, FLEET_LOCK_TOPIC)) {
+    char holder[24] = "";
+    unsigned long epoch = 0;
+    char mode[8] = "";
+    char lock[48];
+    length = min(length, (unsigned int)sizeof(lock) - 1);
+    memcpy(lock, payload, length);
+    lock[length] = 0;
+    sscanf(lock, "%23s %lu %7s", holder, &epoch, mode);
+    bool pinned = !strcmp(mode, "pinned");
+
+    if (!holder[0] || !strcmp(holder, clientId())) return true;
+    if ((long)(time(NULL) - epoch) > FLEET_LOCK_STALE_SECS) return true;  // Left over from a dead leader.
+
+    _lockSeenAt = millis();
+    _electing = false;
+    if (_role == FLEET_LEADER && !(pinned && strcmp(holder, clientId()) < 0)) {
+      claim();  // Configured leader wins, unless another one with a lower id got there.
+    }
+    else if (_leader && !pinned && strcmp(holder, clientId()) > 0) {
+      claim();  // We both claimed; lower id keeps it.
+    }
+    else {
+      setLeader(false);
+    }
+    return true;
+  }
+
+  bool isQuote = !strncmp(topic, FLEET_QUOTE_TOPIC, strlen(FLEET_QUOTE_TOPIC));
+  bool isSeries = !strncmp(topic, FLEET_SERIES_TOPIC, strlen(FLEET_SERIES_TOPIC));
+  if (!isQuote && !isSeries) return false;
+  if (_leader) return true;  // Our own echo.
+
+  int i = find(topic + strlen(isQuote ? FLEET_QUOTE_TOPIC : FLEET_SERIES_TOPIC));
+  if (i < 0 || length < 1 || payload[0] != FLEET_SNAPSHOT_VERSION) return true;
+  YahooFin* yf = _symbols[i];
+
+  if (isQuote) {
+    if (length < sizeof(FleetQuote)) return true;
+    FleetQuote q;
+    memcpy(&q, payload, sizeof(q));
+    yf->regularMarketPrice = q.price;
+    yf->regularMarketDayHigh = q.dayHigh;
+    yf->regularMarketDayLow = q.dayLow;
+    yf->regularMarketPreviousClose = q.previousClose;
+    if (q.previousClose != 0) {
+      yf->regularMarketChangePercent = (q.price / q.previousClose) - 1;
+      yf->regularMarketChange = q.price - q.previousClose;
+    }
+    yf->lastUpdateTime = q.updated;
+    yf->quoteStale = q.flags & FLEET_STALE;
+  }
+  else {
+    FleetSeriesHeader h;
+    if (length < sizeof(h)) return true;
+    memcpy(&h, payload, sizeof(h));
+    if (h.count > MAX_MINUTE_QUOTES || length < sizeof(h) + h.count * sizeof(FleetSeriesBar)) return true;
+    int oldPoints = yf->minuteDataPoints;
+    int firstChanged = h.count;
+    for (int j = 0; j < h.count; j++) {
+      FleetSeriesBar b;
+      memcpy(&b, payload + sizeof(h) + j * sizeof(b), sizeof(b));
+      time_t t = h.firstBarTime + (time_t)b.slot * CHART_INTERVAL_SECS;
+      if (firstChanged == h.count && (j >= oldPoints || yf->minuteTimes[j] != t || yf->minuteQuotes[j] != b.close || yf->minuteVolumes[j] != 0)) firstChanged = j;
+      yf->minuteQuotes[j] = b.close;
+      yf->minuteVolumes[j] = 0;
+      yf->minuteTimes[j] = t;
+    }
+    yf->minuteDataPoints = h.count;
+    // Usually only the last bar or two differ; a leader that restarted or caught up on
+    // volume shifts everything, and refreshIndicators starts over for that.
+    yf->refreshIndicators(h.count >= oldPoints ? firstChanged : 0);
+    yf->firstBarTime = h.count ? yf->minuteTimes[0] : 0;
+    yf->lastBarTime = h.count ? yf->minuteTimes[h.count - 1] : 0;
+    yf->lastChartTime = yf->lastBarTime;
+    // None of it has volume. Should this unit take over, its first chart fetch gets it all.
+    yf->volumeGapFrom = yf->firstBarTime;
+    yf->chartStale = h.flags & FLEET_STALE;
+  }
+  _dirty[i] = true;
+  return true;
+}
@@ -0,0 +1,92 @@
+#include "Arduino.h"
+#include <PubSubClient.h>
+#include "YahooFin.h"
+
+#ifndef QuoteFleet_h
+#define QuoteFleet_h
+
+// Several displays on one broker share one set of Yahoo fetches. The leader fetches (or
+// streams) as usual and publishes binary snapshots to retained topics; followers render
+// from those and do no HTTP at all. A new follower gets the retained snapshots the moment
+// it subscribes, so it draws straight away.
+//
+// Leadership is a retained lock, "<clientId> <epoch>", refreshed by the leader every
+// FLEET_HEARTBEAT_SECS. In FLEET_AUTO a unit claims the lock when it's empty or has gone
+// stale; if two claim at once the lower client id wins. A FLEET_LEADER unit adds "pinned"
+// and takes the lock from any auto unit; between two pinned units the lower id keeps it.
+
+#define FLEET_LOCK_TOPIC "ccdesk/fleet/leader"
+#define FLEET_QUOTE_TOPIC "ccdesk/fleet/quote/"
+#define FLEET_SERIES_TOPIC "ccdesk/fleet/series/"
+#define FLEET_HEARTBEAT_SECS 60
+#define FLEET_LOCK_STALE_SECS (3 * FLEET_HEARTBEAT_SECS)
+#define FLEET_ELECTION_MS 3000  // Wait this long after connect for a retained lock.
+#define FLEET_SNAPSHOT_VERSION 3
+#define FLEET_MAX_SYMBOLS 8
+
+enum FleetRole { FLEET_AUTO, FLEET_LEADER, FLEET_FOLLOWER };
+
+#define FLEET_STALE 0x01  // flags: the leader's last fetch failed; these are cached values.
+
+// Wire formats. Little-endian, packed; every unit runs the same firmware.
+struct __attribute__((packed)) FleetQuote
+{
+  uint8_t version;
+  uint8_t flags;
+  uint32_t updated;  // epoch seconds
+  float price;
+  float dayHigh;
+  float dayLow;
+  float previousClose;
+};
+
+struct __attribute__((packed)) FleetSeriesHeader
+{
+  uint8_t version;
+  uint8_t flags;
+  uint16_t count;
+  uint32_t firstBarTime;
+  // followed by count FleetSeriesBars
+};
+
+// Volumes aren't shared, so followers draw no VWAP and don't keep the bars on flash.
+struct __attribute__((packed)) FleetSeriesBar
+{
+  uint16_t slot;     // (time - firstBarTime) / CHART_INTERVAL_SECS
+  float close;
+};
+
+class QuoteFleet
+{
+  public:
+    QuoteFleet(PubSubClient& mqtt, FleetRole role);
+    void add(YahooFin* yf);
+    const char* clientId();
+    void onConnect();
+    bool handleMessage(char* topic, byte* payload, unsigned int length);
+    void loop();
+    bool isLeader() { return _leader; }
+    bool takeRoleChanged();
+    bool takeDirty(YahooFin* yf);
+    void publishQuote(YahooFin* yf);
+    void publishSeries(YahooFin* yf);
+
+  private:
+    void claim();
+    void setLeader(bool leader);
+    int find(const char* symbol);
+    PubSubClient& _mqtt;
+    FleetRole _role;
+    char _clientId[24];
+    bool _leader;
+    bool _roleChanged;
+    bool _electing;
+    unsigned long _connectedAt;
+    unsigned long _lockSeenAt;   // millis() we last saw another unit's lock
+    unsigned long _heartbeatAt;
+    YahooFin* _symbols[FLEET_MAX_SYMBOLS];
+    bool _dirty[FLEET_MAX_SYMBOLS];
+    int _count;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include "Arduino.h"
+#include "QuoteStream.h"
+#include <ArduinoJson.h>
+#include "PricingData.h"
+
+QuoteStream::QuoteStream(const char* host, uint16_t port, const char* path, bool ssl)
+{
+  _host = host;
+  _port = port;
+  _path = path;
+  _ssl = ssl;
+  _connected = false;
+  _reconnected = false;
+  _count = 0;
+  ticks = 0;
+}
+
+void QuoteStream::add(YahooFin* yf)
+{
+  if (_count >= STREAM_MAX_SYMBOLS) return;
+  _symbols[_count] = yf;
+  _dirty[_count] = false;
+  _count++;
+}
+
+void QuoteStream::begin()
+{
+  if (_ssl) _ws.beginSSL(_host, _port, _path);
+  else _ws.begin(_host, _port, _path);
+  _ws.onEvent([this](WStype_t type, uint8_t* payload, size_t length) { onEvent(type, payload, length); });
+  _ws.setReconnectInterval(5000);
+  _ws.enableHeartbeat(15000, 3000, 2);
+  ESP_LOGI("CCD", "Quote stream: %s://%s:%d%s", _ssl ? "wss" : "ws", _host, _port, _path);
+}
+
+void QuoteStream::loop()
+{
+  _ws.loop();
+}
+
+// True once per batch of ticks for this symbol since the last call. Lets the caller redraw
+// at its own pace rather than on every tick.
+bool QuoteStream::takeDirty(YahooFin* yf)
+{
+  for (int i = 0; i < _count; i++) {
+    if (_symbols[i] == yf) {
+      bool dirty = _dirty[i];
+      _dirty[i] = false;
+      return dirty;
+    }
+  }
+  return false;
+}
+
+// True once after each (re)connect, so the caller can backfill anything missed while down.
+bool QuoteStream::takeReconnected()
+{
+  bool r = _reconnected;
+  _reconnected = false;
+  return r;
+}
+
+void QuoteStream::onEvent(WStype_t type, uint8_t* payload, size_t length)
+{
+  switch (type) {
+    case WStype_CONNECTED:
+      ESP_LOGI("CCD","%s","Quote stream connected");
+      _connected = true;
+      _reconnected = true;
+      subscribe();
+      break;
+    case WStype_DISCONNECTED:
+      if (_connected) ESP_LOGI("CCD","%s","Quote stream disconnected");
+      _connected = false;
+      break;
+    case WStype_TEXT:
+      handleMessage(payload, length);
+      break;
+    default:
+      break;
+  }
+}
+
+void QuoteStream::subscribe()
+{
+  char msg[160];
+  int len = snprintf(msg, sizeof(msg), "{\"subscribe\":[");
+  for (int i = 0; i < _count && len < (int)sizeof(msg); i++) {
+    len += snprintf(msg + len, sizeof(msg) - len, "%s\"%s\"", i ? "," : "", _symbols[i]->getSymbol());
+  }
+  if (len < (int)sizeof(msg)) snprintf(msg + len, sizeof(msg) - len, "]}");
+  _ws.sendTXT(msg);
+}
+
+void QuoteStream::handleMessage(uint8_t* payload, size_t length)
+{
+  const char* b64 = (const char*)payload;
+  size_t b64Len = length;
+
+  // Newer streamer versions wrap the protobuf in a small JSON envelope.
+  StaticJsonDocument<64> filter;
+  StaticJsonDocument<512> envelope;
+  if (length && payload[0] == '{') {
+    filter["message"] = true;
+    if (deserializeJson(envelope, (const char*)payload, length, DeserializationOption::Filter(filter))) return;
+    const char* msg = envelope["message"];
+    if (msg == NULL) return;
+    b64 = msg;
+    b64Len = strlen(msg);
+  }
+
+  PricingTick tick;
+  if (!decodePricingBase64(b64, b64Len, &tick)) {
+    ESP_LOGE("CCD", "Quote stream: bad message (%u bytes)", (unsigned)length);
+    return;
+  }
+  applyTick(tick);
+}
+
+void QuoteStream::applyTick(const PricingTick& tick)
+{
+  for (int i = 0; i < _count; i++) {
+    YahooFin* yf = _symbols[i];
+    if (strcmp(tick.id, yf->getSymbol())) continue;
+    // A worker owns the object mid-fetch; the fetch brings back the same data anyway.
+    if (yf->fetchPending) return;
+    time_t when = tick.timeMs ? (time_t)(tick.timeMs / 1000) : time(NULL);
+    yf->applyTick(tick.price, when, tick.dayHigh, tick.dayLow, tick.previousClose);
+    _dirty[i] = true;
+    ticks++;
+    return;
+  }
+}
@@ -0,0 +1,47 @@
+#include "Arduino.h"
+#include <WebSocketsClient.h>
+#include "YahooFin.h"
+#include "PricingData.h"
+
+#ifndef QuoteStream_h
+#define QuoteStream_h
+
+// Push quotes from Yahoo's streamer (or a local relay speaking the same protocol) into the
+// same YahooFin objects the poller fills, so all the drawing code stays as it is.
+//
+// Protocol: send {"subscribe":["ACN",...]} once connected. Each message is a base64
+// PricingData protobuf (see PricingData.h), either bare or wrapped as
+// {"type":"pricing","message":"..."}.
+
+#define STREAM_MAX_SYMBOLS 8
+
+class QuoteStream
+{
+  public:
+    QuoteStream(const char* host, uint16_t port, const char* path, bool ssl);
+    void add(YahooFin* yf);
+    void begin();
+    void loop();
+    bool connected() { return _connected; }
+    bool takeDirty(YahooFin* yf);
+    bool takeReconnected();
+    unsigned long ticks;
+
+  private:
+    void onEvent(WStype_t type, uint8_t* payload, size_t length);
+    void subscribe();
+    void handleMessage(uint8_t* payload, size_t length);
+    void applyTick(const PricingTick& tick);
+    WebSocketsClient _ws;
+    const char* _host;
+    uint16_t _port;
+    const char* _path;
+    bool _ssl;
+    bool _connected;
+    bool _reconnected;
+    YahooFin* _symbols[STREAM_MAX_SYMBOLS];
+    bool _dirty[STREAM_MAX_SYMBOLS];
+    int _count;
+};
+
+#endif
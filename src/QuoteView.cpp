@@ -0,0 +1,143 @@
+#include "Arduino.h"
+#include "QuoteView.h"
+#include <math.h>
+
+// Waveform points drawn for the bars before `bar`: two for two bars in three.
+static int pointOf(int bar)
+{
+  return 2 * bar - (bar + 2) / 3;
+}
+
+// One watchlist line on page 0. Out of hours the change since the close isn't news, so
+// just the price.
+void drawQuoteLine(NexUI& nex, const YahooFin& yf, const NexComponent& field, bool withChange)
+{
+  char quote_msg[30];
+  
+  if(withChange)
+  {
+    snprintf(quote_msg, sizeof(quote_msg), "$%.2f($%.2f/%.2f%%)", yf.regularMarketPrice, yf.regularMarketChange, yf.regularMarketChangePercent * 100);
+
+    nex.setText(field, ui::txt, quote_msg);
+
+    if (yf.quoteStale) nex.setColor(field, ui::pco, ui::stale);
+    else if (yf.regularMarketChange < 0) nex.setColor(field, ui::pco, ui::down);
+    else nex.setColor(field, ui::pco, ui::up);
+  }
+  else
+  {
+    snprintf(quote_msg, sizeof(quote_msg), "$%.2f", yf.regularMarketPrice);
+
+    nex.setText(field, ui::txt, quote_msg);
+    nex.setColor(field, ui::pco, yf.quoteStale ? ui::stale : ui::flat);
+    
+  }
+}
+
+// The quote line and intraday waveform on page 2. Returns false if there's no series yet,
+// in which case only the quote line went out.
+bool drawGraphPage(NexUI& nex, const YahooFin& yf, bool overlaysWanted)
+{
+  // Update the detailed quote on page.
+  char quote_msg[30];
+
+  snprintf(quote_msg, sizeof(quote_msg), "%.2f(%.2f/%.2f%%)", yf.regularMarketPrice, yf.regularMarketChange, yf.regularMarketChangePercent * 100);
+  if (yf.quoteStale) nex.setColor(ui::tQuote, ui::pco, ui::stale);
+  else if (yf.regularMarketChange < 0) nex.setColor(ui::tQuote, ui::pco, ui::down);
+  else nex.setColor(ui::tQuote, ui::pco, ui::up);
+
+  nex.setText(ui::tQuote, ui::txt, quote_msg);
+
+  // Update the chart
+  if (yf.minuteDataPoints == 0) return false;
+
+  // Clear the graph...we can think about adding on to it later.
+  nex.waveClear(ui::sGraphId, 0);
+  nex.waveClear(ui::sGraphId, 1);
+
+  IntradayIndicators* ind = yf.indicators;
+  bool synced = ind && ind->count == yf.minuteDataPoints;
+  bool overlays = overlaysWanted && synced;
+  bool drawVwap = overlays && ind->hasVolume();
+  if (overlays) {
+    nex.waveClear(ui::sGraphId, GRAPH_CH_VWAP);
+    nex.waveClear(ui::sGraphId, GRAPH_CH_MA);
+  }
+
+  // Change the line color based on up/down
+  if (yf.quoteStale || yf.chartStale) nex.setColor(ui::sGraph, ui::pco0, ui::stale);
+  else if (yf.regularMarketChange < 0) nex.setColor(ui::sGraph, ui::pco0, ui::down);
+  else nex.setColor(ui::sGraph, ui::pco0, ui::up);
+
+  // Figure out scale
+  long scaleLow = floor(min(yf.regularMarketPreviousClose, yf.regularMarketDayLow)) * 100;
+  long scaleHigh = ceil(max(yf.regularMarketPreviousClose, yf.regularMarketDayHigh)) * 100;
+
+  long pc = map((long)(yf.regularMarketPreviousClose * 100), scaleLow, scaleHigh, 0, 255);  // Previous close line.
+  long vwapVal = 0;
+  long maVal = 0;
+  const float* ma = synced ? (GRAPH_MA_SMA ? ind->sma : ind->ema) : NULL;
+
+  // The indicators keep the day's high and low close as they go; without them, find them
+  // on the way through.
+  int high = 0;
+  int highI = 0;
+  int low = 999;
+  int lowI = 0;
+  int j = 0;
+  if (synced) {
+    high = map((long)(ind->maxClose() * 100), scaleLow, scaleHigh, 0, 255);
+    highI = pointOf(ind->maxIndex());
+    low = map((long)(ind->minClose() * 100), scaleLow, scaleHigh, 0, 255);
+    lowI = pointOf(ind->minIndex());
+  }
+
+  for (int i = 0; i < yf.minuteDataPoints; i++)
+  {
+
+    if (yf.minuteQuotes[i] > 0) {
+
+      long mappedVal = map((long)(yf.minuteQuotes[i] * 100), scaleLow, scaleHigh, 0, 255);
+
+      if (!synced && mappedVal >= high) {
+        high = mappedVal;
+        highI = j;
+      }
+
+      if (!synced && mappedVal <= low) {
+        low = mappedVal;
+        lowI = j;
+      }
+
+      if (overlays) {
+        vwapVal = constrain(map((long)(ind->vwap[i] * 100), scaleLow, scaleHigh, 0, 255), 0, 255);
+        maVal = constrain(map((long)(ma[i] * 100), scaleLow, scaleHigh, 0, 255), 0, 255);
+      }
+
+      // Twice for two bars in three, to stretch the graph a bit.
+      for (int k = (i % 3) ? 2 : 1; k > 0; k--) {
+        nex.waveAdd(ui::sGraphId, 0, mappedVal);
+        nex.waveAdd(ui::sGraphId, 1, pc);
+        if (drawVwap) nex.waveAdd(ui::sGraphId, GRAPH_CH_VWAP, vwapVal);
+        if (overlays) nex.waveAdd(ui::sGraphId, GRAPH_CH_MA, maVal);
+        j++;
+      }
+    }
+  }
+
+  // Update the min/max/last overlay
+
+  delay(80); //Delay allows the transparent text to work.
+
+  char controlDesc[55];  //"xstr 245, 355,88,26,0,56154,0,0,1,3,123.45" about 45.
+  snprintf(controlDesc, sizeof(controlDesc), "xstr %d,%d,88,26,0,%u,0,0,1,3,\"%.2f\"", min(245, highI), 255 - high - 4, ui::label.value, yf.regularMarketDayHigh);
+  nex.command(controlDesc);
+
+  snprintf(controlDesc, sizeof(controlDesc), "xstr %d,%d,88,26,0,%u,0,0,1,3,\"%.2f\"", min(245, lowI), 255 - low + 26, ui::label.value, yf.regularMarketDayLow);
+  nex.command(controlDesc);
+
+  snprintf(controlDesc, sizeof(controlDesc), "xstr %d,%d,88,26,0,%u,0,0,1,3,\"%.2f\"", min(245, j), 255 - (int)pc, ui::label.value, yf.regularMarketPreviousClose);
+  nex.command(controlDesc);
+
+  return true;
+}
@@ -0,0 +1,23 @@
+#include "Arduino.h"
+#include "NexUI.h"
+#include "YahooFin.h"
+
+#ifndef QuoteView_h
+#define QuoteView_h
+
+// What pages 0 and 2 show of a YahooFin, written through NexUI. Nothing here knows which
+// page is up or fetches anything; the callers in CCDeskDisplayPIO.cpp see to that. Kept
+// apart so test/test_pages can draw both pages into the Nextion emulator.
+
+#define GRAPH_CH_VWAP 2
+#define GRAPH_CH_MA 3
+
+// The moving average on GRAPH_CH_MA: the 9 bar EMA, or with -DGRAPH_MA_SMA=1 the 20 bar SMA.
+#ifndef GRAPH_MA_SMA
+#define GRAPH_MA_SMA 0
+#endif
+
+void drawQuoteLine(NexUI& nex, const YahooFin& yf, const NexComponent& field, bool withChange);
+bool drawGraphPage(NexUI& nex, const YahooFin& yf, bool overlays);
+
+#endif
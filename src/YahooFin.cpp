@@ -2,15 +2,152 @@
 #include "YahooFin.h"
 #include <WiFi.h>
 #include <HTTPClient.h>
+#include <WiFiClientSecure.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/pk.h>
+#include <mbedtls/bignum.h>
 #include <time.h>
 #include "yahoo_cert.h"
 #include <ArduinoJson.h>
+#include "MemTelemetry.h"
+#include "GzipStream.h"
+
+// Heap a TLS session needs on top of the inflate window: mbedtls with its 16K record buffers
+// each way, and some for the handshake. Short of both, fetch uncompressed.
+#define TLS_HEAP_NEEDED 45000
+
+// The handshake ran out of heap. The check before asking for gzip can't hold the TLS share
+// for us: the other workers and the stream may take it before the handshake gets there.
+static bool tlsOutOfHeap(int err)
+{
+  return err == MBEDTLS_ERR_SSL_ALLOC_FAILED || err == MBEDTLS_ERR_PK_ALLOC_FAILED || err == MBEDTLS_ERR_MPI_ALLOC_FAILED;
+}
+
+// Tight timeouts: a healthy response is well under a second, and a slow one is better
+// served from cache. Two misses in a row open the circuit for 15s, doubling to 10 minutes.
+EndpointHealth quoteHealth("quote", 3000, 15000, 600000, 2);
+EndpointHealth chartHealth("chart", 4000, 15000, 600000, 2);
 
 YahooFin::YahooFin(char* symbol)
 {
   _symbol = symbol;
   regularMarketPrice = 0;
+  minuteDataPoints = 0;
+  firstBarTime = 0;
+  lastBarTime = 0;
+  volumeGapFrom = 0;
+  indicators = NULL;
+  lastUpdateTime = 0;
+  lastChartTime = 0;
   lastUpdateOfDayDone = false;
+  quoteStale = false;
+  chartStale = false;
+  fetchPending = false;
+  lastWireBytes = 0;
+  lastFetchMs = 0;
+  _timeoutMs = 5000;
+}
+
+// Connect and read timeout for each HTTP request. HTTPClient's default is long enough
+// that a slow Yahoo response stalls the caller for a good while.
+void YahooFin::setTimeout(uint16_t timeoutMs)
+{
+  _timeoutMs = timeoutMs;
+}
+
+// GET url and parse it through filter into doc. Asks for gzip when the inflate window can be
+// had and still leave room for TLS, and inflates on the fly; the body is never buffered.
+// A chart response is mostly timestamp/OHLC/volume arrays the filter throws away, so
+// it compresses several times over.
+//
+// Goes through health: refused outright while its circuit is open, and timeouts, 429s,
+// 5xx and truncated bodies count against it. Other HTTP errors are this request's problem,
+// not the endpoint's, and so is running out of heap here, TLS handshake included.
+bool YahooFin::fetchJson(const char* url, JsonDocument& doc, JsonDocument& filter, EndpointHealth& health)
+{
+  if (!health.allow()) {
+    ESP_LOGD("CCD", "Skipping %s, circuit open", _symbol);
+    return false;
+  }
+
+  unsigned long start = millis();
+  WiFiClientSecure tls;  // Ours rather than HTTPClient's, so its mbedtls error can be read.
+  WiFiClient plain;
+  HTTPClient client;
+  uint16_t timeoutMs = min(_timeoutMs, health.timeoutMs());
+
+  client.useHTTP10(true);
+  client.setConnectTimeout(timeoutMs);
+  client.setTimeout(timeoutMs);
+  const char* headers[] = { "Content-Encoding", "Retry-After" };
+  client.collectHeaders(headers, 2);
+
+  GzipStream gzipBody;
+  bool askGzip = YAHOO_GZIP && ESP.getFreeHeap() > GZIP_HEAP_NEEDED + TLS_HEAP_NEEDED && gzipBody.reserve();
+
+  bool https = !strncmp(url, "https:", 6);
+  if (https) {
+    tls.setCACert(cert_DigiCert_SHA2_High_Assurance_Server_CA);
+    client.begin(tls, url);
+  }
+  else client.begin(plain, url);
+  if (askGzip) client.addHeader("Accept-Encoding", "gzip");
+  int httpCode = client.GET();
+
+  if (httpCode != HTTP_CODE_OK) {
+    ESP_LOGE("CCD", "%s: HTTP %d", _symbol, httpCode);
+    int retryAfter = client.header("Retry-After").toInt();
+    client.end();
+    char tlsError[64];
+    if (https && httpCode <= 0 && tlsOutOfHeap(tls.lastError(tlsError, sizeof(tlsError)))) {
+      ESP_LOGW("CCD", "%s: TLS handshake out of heap, %s", _symbol, tlsError);
+      health.release();
+    }
+    else if (httpCode <= 0 || httpCode == 429 || httpCode >= 500) health.failure(millis() - start, retryAfter);
+    else health.success();
+    return false;
+  }
+
+  DeserializationError err;
+  bool gzip = client.header("Content-Encoding") == "gzip";
+  if (gzip) {
+    // Not asked for, so there may be no window yet. No heap for one is our problem.
+    if (!askGzip && !gzipBody.reserve()) {
+      client.end();
+      health.release();
+      return false;
+    }
+    if (!gzipBody.begin(client.getStream())) {
+      client.end();
+      health.failure(millis() - start, 0);
+      return false;
+    }
+    err = deserializeJson(doc, gzipBody, DeserializationOption::Filter(filter));
+    lastWireBytes = gzipBody.wireBytes;
+    ESP_LOGD("CCD", "gzip: %u bytes inflated to %u", (unsigned)gzipBody.wireBytes, (unsigned)gzipBody.inflatedBytes);
+  }
+  else {
+    err = deserializeJson(doc, client.getStream(), DeserializationOption::Filter(filter));
+    lastWireBytes = client.getSize();  // -1 if the server didn't send a length.
+  }
+  client.end();
+
+  lastFetchMs = millis() - start;
+  health.fetched(lastWireBytes, gzip, lastFetchMs);
+  ESP_LOGI("CCD", "Fetched %s: %d bytes on the wire (%s), %lums", _symbol, lastWireBytes, gzip ? "gzip" : "identity", lastFetchMs);
+
+  if (err) {
+    ESP_LOGE("CCD", "Failed to parse response to JSON with %s", err.c_str());
+    // A body cut short by the read timeout is the endpoint stalling, and an empty or
+    // garbled one is it misbehaving. Out of memory or nesting is ours: hand a half-open
+    // circuit back rather than leave it shut waiting on this probe.
+    if (err == DeserializationError::IncompleteInput || err == DeserializationError::InvalidInput ||
+        err == DeserializationError::EmptyInput) health.failure(lastFetchMs, 0);
+    else health.release();
+    return false;
+  }
+  health.success();
+  return true;
 }
 
 bool YahooFin::isMarketOpen()
@@ -38,68 +175,52 @@ bool YahooFin::isChangeInteresting()
       && ((timeinfo.tm_hour > 8 || (timeinfo.tm_hour==8 && timeinfo.tm_min >=30))));  
 }
 
-void YahooFin::getQuote()
+bool YahooFin::getQuote()
 {
+  MEM_SITE("getQuote");
   Serial.printf("Getting quote for %s. Mkt open? %d price? %f, last update done? %d\n", this->_symbol, this->isMarketOpen(), regularMarketPrice, lastUpdateOfDayDone);
   if (this->isMarketOpen() || regularMarketPrice == 0 || !lastUpdateOfDayDone)
   {
-    lastUpdateOfDayDone = !this->isMarketOpen();
-    
-    HTTPClient client;
-  
-    client.useHTTP10(true);
-    
     DynamicJsonDocument doc(8192);
-   ESP_LOGD("CCD","%s","Doc capacity: %d", doc.capacity());
-   
-   StaticJsonDocument<512> filter;
-   filter["chart"]["result"][0]["meta"]["regularMarketPrice"]= true;
-   filter["chart"]["result"][0]["meta"]["chartPreviousClose"]= true;
-   filter["chart"]["result"][0]["indicators"]["quote"][0]["high"][0]= true;
-   filter["chart"]["result"][0]["indicators"]["quote"][0]["low"][0]= true;
-   
+    ESP_LOGD("CCD","%s","Doc capacity: %d", doc.capacity());
 
-   char url[80];
-   sprintf(url, "https://query1.finance.yahoo.com/v8/finance/chart/%s?interval=1d",_symbol); 
-   client.begin(url, cert_DigiCert_SHA2_High_Assurance_Server_CA);
-   int httpCode = client.GET();
+    StaticJsonDocument<512> filter;
+    filter["chart"]["result"][0]["meta"]["regularMarketPrice"]= true;
+    filter["chart"]["result"][0]["meta"]["chartPreviousClose"]= true;
+    filter["chart"]["result"][0]["indicators"]["quote"][0]["high"][0]= true;
+    filter["chart"]["result"][0]["indicators"]["quote"][0]["low"][0]= true;
 
-   if (httpCode > 0) {
-     
-     auto err = deserializeJson(doc, client.getStream(), DeserializationOption::Filter(filter));
-     client.end();
+    char url[128];
+    snprintf(url, sizeof(url), YAHOO_BASE_URL "/v8/finance/chart/%s?interval=1d",_symbol);
+    if (!fetchJson(url, doc, filter, quoteHealth)) {
+      quoteStale = true;
+      return false;
+    }
+    // Only now: a failed fetch after the close has to be retried, not taken as the day's last.
+    lastUpdateOfDayDone = !this->isMarketOpen();
+    quoteStale = false;
 
-     if (err) {
-       ESP_LOGE("CCD","%s","Failed to parse response to JSON with " + String(err.c_str()));
-     }
+    // serializeJsonPretty(doc, Serial);
 
-   // serializeJsonPretty(doc, Serial);
-  
-      regularMarketPrice=doc["chart"]["result"][0]["meta"]["regularMarketPrice"].as<float>(); 
-      regularMarketPreviousClose=doc["chart"]["result"][0]["meta"]["chartPreviousClose"].as<float>();
-      regularMarketDayHigh=doc["chart"]["result"][0]["indicators"]["quote"][0]["high"][0].as<float>();
-      regularMarketDayLow=doc["chart"]["result"][0]["indicators"]["quote"][0]["low"][0].as<float>();
-
-      if(regularMarketPreviousClose != 0)
-      {
-        regularMarketChangePercent= (regularMarketPrice/regularMarketPreviousClose) - 1;
-        regularMarketChange=regularMarketPrice - regularMarketPreviousClose;
-      }
-      else
-      {
-        regularMarketChangePercent = 0;
-        regularMarketChange = 0;
-      }
+    regularMarketPrice=doc["chart"]["result"][0]["meta"]["regularMarketPrice"].as<float>(); 
+    regularMarketPreviousClose=doc["chart"]["result"][0]["meta"]["chartPreviousClose"].as<float>();
+    regularMarketDayHigh=doc["chart"]["result"][0]["indicators"]["quote"][0]["high"][0].as<float>();
+    regularMarketDayLow=doc["chart"]["result"][0]["indicators"]["quote"][0]["low"][0].as<float>();
 
-      time(&lastUpdateTime);
+    if(regularMarketPreviousClose != 0)
+    {
+      regularMarketChangePercent= (regularMarketPrice/regularMarketPreviousClose) - 1;
+      regularMarketChange=regularMarketPrice - regularMarketPreviousClose;
     }
-    else {
-      ESP_LOGE("CCD","%s","Error on HTTP request");
-      ESP_LOGE("CCD","%s",httpCode);
+    else
+    {
+      regularMarketChangePercent = 0;
+      regularMarketChange = 0;
     }
-    client.end();
+
+    time(&lastUpdateTime);
   }
-  
+  return true;
 }
 
 void YahooFin::getQuoteX()
@@ -122,7 +243,7 @@ void YahooFin::getQuoteX()
     int httpCode = client.GET();
   
     if (httpCode > 0) {
-      ESP_LOGV("CCD","%s",httpCode);
+      ESP_LOGV("CCD","HTTP %d", httpCode);
       auto err = deserializeJson(doc, client.getStream());
       if (err) {
         Serial.println("Failed to parse response to JSON with " + String(err.c_str()));
@@ -138,8 +259,7 @@ void YahooFin::getQuoteX()
       time(&lastUpdateTime);
     }
     else {
-      ESP_LOGE("CCD","%s","Error on HTTP request");
-      ESP_LOGE("CCD","%s",httpCode);
+      ESP_LOGE("CCD","Error on HTTP request: %d", httpCode);
     }
   
     doc.clear();
@@ -147,43 +267,169 @@ void YahooFin::getQuoteX()
   }
 }
 
-void YahooFin::getChart(){
-   HTTPClient client;
-   client.useHTTP10(true);
-   
-   DynamicJsonDocument doc(8192);
+static bool sameDay(time_t a, time_t b)
+{
+  struct tm ta, tb;
+  localtime_r(&a, &ta);
+  localtime_r(&b, &tb);
+  return ta.tm_year == tb.tm_year && ta.tm_yday == tb.tm_yday;
+}
+
+bool YahooFin::getChart(){
+   MEM_SITE("getChart");
+   DynamicJsonDocument doc(12288);  // Three arrays of up to 195 now that volume is in.
    ESP_LOGD("CCD","%s","Doc capacity: %d", doc.capacity());
    
-   StaticJsonDocument<112> filter;
+   StaticJsonDocument<192> filter;
+   filter["chart"]["result"][0]["timestamp"] = true;
    filter["chart"]["result"][0]["indicators"]["quote"][0]["close"] = true;
+   filter["chart"]["result"][0]["indicators"]["quote"][0]["volume"] = true;
 
-   char url[80];
-   sprintf(url, "https://query1.finance.yahoo.com/v8/finance/chart/%s?interval=2m",_symbol); 
-   client.begin(url, cert_DigiCert_SHA2_High_Assurance_Server_CA);
-   int httpCode = client.GET();
+   // Already holding part of today (from flash, or an earlier fetch)? Then only ask for the
+   // last fetched bar, which may still have been forming, and whatever has come since. Bars
+   // built from ticks have no volume, so those are asked for again too. It's the first bar
+   // that says whose series it is: ticks move the last one into today while the rest is
+   // still yesterday's. A series the ticks started has nothing fetched to go on from.
+   time_t now = time(NULL);
+   bool incremental = minuteDataPoints > 0 && sameDay(firstBarTime, now) && !startedByTicks();
+   time_t from = lastBarTime;
+   for (int i = 1; volumeGapFrom && i < minuteDataPoints; i++) {
+     if (minuteTimes[i] >= volumeGapFrom) {
+       from = minuteTimes[i - 1];
+       break;
+     }
+   }
 
-   if (httpCode > 0) {
-     
-     auto err = deserializeJson(doc, client.getStream(), DeserializationOption::Filter(filter));
-     client.end();
+   char url[160];
+   if (incremental) snprintf(url, sizeof(url), YAHOO_BASE_URL "/v8/finance/chart/%s?interval=2m&period1=%ld&period2=%ld",_symbol, (long)from, (long)now);
+   else snprintf(url, sizeof(url), YAHOO_BASE_URL "/v8/finance/chart/%s?interval=2m",_symbol);
+   if (!fetchJson(url, doc, filter, chartHealth)) {
+     chartStale = true;
+     return false;
+   }
+   chartStale = false;
 
-     if (err) {
-       ESP_LOGE("CCD","%s","Failed to parse response to JSON with " + String(err.c_str()));
-     }
-     JsonArray arr = doc["chart"]["result"][0]["indicators"]["quote"][0]["close"].as<JsonArray>();
-     int i = 0;
-     minuteDataPoints = 0;
-     for (JsonVariant value : arr) {
-        if(!value.isNull()) {
-          if(i>=195) continue;
-          minuteQuotes[i++] = value.as<double>();
-          minuteDataPoints++;          
+   JsonArray arr = doc["chart"]["result"][0]["indicators"]["quote"][0]["close"].as<JsonArray>();
+   JsonArray stamps = doc["chart"]["result"][0]["timestamp"].as<JsonArray>();
+   JsonArray volumes = doc["chart"]["result"][0]["indicators"]["quote"][0]["volume"].as<JsonArray>();
+   int bar = 0;
+   int oldPoints = minuteDataPoints;
+   int firstChanged = -1;
+   time_t oldFirstBar = firstBarTime;
+   int n = incremental ? minuteDataPoints : 0;
+   for (JsonVariant value : arr) {
+      if(!value.isNull()) {
+        uint32_t t = stamps[bar].as<long>();
+        while (n > 0 && t <= minuteTimes[n - 1]) n--;  // A bar we hold, now final (or further along).
+        if (n < MAX_MINUTE_QUOTES) {
+          double close = value.as<double>();
+          float volume = volumes[bar].as<float>();
+          if (firstChanged < 0 && (n >= oldPoints || minuteTimes[n] != t || minuteQuotes[n] != close || minuteVolumes[n] != volume)) firstChanged = n;
+          minuteTimes[n] = t;
+          minuteVolumes[n] = volume;
+          minuteQuotes[n++] = close;
         }
-     }
+      }
+      bar++;
+   }
+   if (firstChanged < 0) firstChanged = n;
+   minuteDataPoints = n;
+   volumeGapFrom = 0;
+   if (n > 0) {
+     firstBarTime = minuteTimes[0];
+     lastBarTime = minuteTimes[n - 1];
+   }
+   ESP_LOGD("CCD", "Chart %s: %d bars, %s", _symbol, n, incremental ? "incremental" : "full");
+
+   // Same day: feed from the first bar that came back different, normally our old last bar.
+   // Anything earlier (tick-built bars getting their volume) starts the indicators over.
+   // New day: start over.
+   refreshIndicators(firstBarTime == oldFirstBar ? firstChanged : 0);
+   time(&lastChartTime);
+   doc.clear();
+   return true;
+}
+
+// Fold one streamed trade into the quote and the intraday series. A tick in the current
+// bar replaces its close; a tick past it starts a new bar. Zero means "not in this tick".
+void YahooFin::applyTick(double price, time_t when, double dayHigh, double dayLow, double previousClose)
+{
+  if (price <= 0) return;
+
+  regularMarketPrice = price;
+  if (previousClose > 0) regularMarketPreviousClose = previousClose;
+  if (dayHigh > 0) regularMarketDayHigh = dayHigh;
+  else if (price > regularMarketDayHigh) regularMarketDayHigh = price;
+  if (dayLow > 0) regularMarketDayLow = dayLow;
+  else if (regularMarketDayLow == 0 || price < regularMarketDayLow) regularMarketDayLow = price;
+
+  if (regularMarketPreviousClose != 0) {
+    regularMarketChangePercent = (regularMarketPrice / regularMarketPreviousClose) - 1;
+    regularMarketChange = regularMarketPrice - regularMarketPreviousClose;
   }
-  else {
-    ESP_LOGE("CCD","%s","Error on HTTP request");
-    client.end();
+
+  // The first tick of a new day starts the day's series over; what's held is the last
+  // session's (restored from flash, or left from yesterday). A late tick from before it
+  // only moves the quote.
+  time_t bar = when - (when % CHART_INTERVAL_SECS);
+  bool newDay = minuteDataPoints > 0 && !sameDay(bar, lastBarTime);
+  bool late = newDay && bar < lastBarTime;
+  if (newDay && !late) {
+    minuteDataPoints = 0;
+    firstBarTime = 0;
+    lastBarTime = 0;
+    volumeGapFrom = 0;
+    if (indicators) indicators->reset();
+  }
+
+  bool merged = false;
+  if (late) {
+    // Nothing for the series.
+  }
+  else if (minuteDataPoints > 0 && bar <= lastBarTime) {
+    minuteQuotes[minuteDataPoints - 1] = price;
+    if (indicators) indicators->updateLastBar(price, minuteVolumes[minuteDataPoints - 1]);
+    merged = true;
+  }
+  else if (minuteDataPoints < MAX_MINUTE_QUOTES) {
+    if (minuteDataPoints == 0) firstBarTime = bar;
+    minuteTimes[minuteDataPoints] = bar;
+    minuteVolumes[minuteDataPoints] = 0;  // Ticks don't carry per-bar volume; the next chart fetch fills it in.
+    minuteQuotes[minuteDataPoints++] = price;
+    if (volumeGapFrom == 0) volumeGapFrom = bar;
+    lastBarTime = bar;
+    if (indicators) indicators->addBar(price, 0);
+    merged = true;
+  }
+
+  lastUpdateTime = when;
+  quoteStale = false;
+  // The chart only counts as fresh if the tick is in today's series and a chart fetch has
+  // already filled in the day up to the ticks. Otherwise leave it stale for the next fetch.
+  if (merged) chartStale = false;
+  if (merged && !startedByTicks() && sameDay(bar, time(NULL))) lastChartTime = when;
+}
+
+void YahooFin::attachIndicators(IntradayIndicators* ind)
+{
+  indicators = ind;
+  refreshIndicators(0);
+}
+
+// Bring the indicators up to date with minuteQuotes, given that bars before `from` haven't
+// changed since they were last fed. Normally that's just the last bar plus anything new;
+// from any earlier the running sums can't be unwound, so it starts over.
+void YahooFin::refreshIndicators(int from)
+{
+  if (!indicators) return;
+  if (from < 0) from = 0;
+
+  if (from < indicators->count - 1 || from > indicators->count || minuteDataPoints < indicators->count) {
+    indicators->reset();
+    from = 0;
+  }
+  for (int i = from; i < minuteDataPoints; i++) {
+    if (i == indicators->count - 1) indicators->updateLastBar(minuteQuotes[i], minuteVolumes[i]);
+    else indicators->addBar(minuteQuotes[i], minuteVolumes[i]);
   }
-  doc.clear();
 }
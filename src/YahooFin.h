@@ -1,17 +1,44 @@
 #include "Arduino.h"
+#include <ArduinoJson.h>
+#include "IntradayIndicators.h"
+#include "EndpointHealth.h"
 
 #ifndef YahooFin_h
 #define YahooFin_h
 
+#define MAX_MINUTE_QUOTES 195   // 6.5 hour session at 2 minute bars.
+#define CHART_INTERVAL_SECS 120 // Must match interval=2m in getChart().
+
+// Override with -DYAHOO_BASE_URL=\"http://192.168.1.20:8080\" to point at a local stand-in
+// (plain http is fine) that can be made slow, rate limited or broken on demand.
+#ifndef YAHOO_BASE_URL
+#define YAHOO_BASE_URL "https://query1.finance.yahoo.com"
+#endif
+
+// -DYAHOO_GZIP=0 fetches uncompressed, to compare bytes and times on stat/DesktopBuddy/health/*.
+#ifndef YAHOO_GZIP
+#define YAHOO_GZIP 1
+#endif
+
+// Shared by every symbol: when Yahoo is down it's down for all of them.
+extern EndpointHealth quoteHealth;
+extern EndpointHealth chartHealth;
+
 class YahooFin
 {
   public:
     YahooFin(char* symbol);
     bool isMarketOpen();
     bool isChangeInteresting();
-    void getQuote();
+    bool getQuote();
     void getQuoteX();
-    void getChart();
+    bool getChart();
+    void setTimeout(uint16_t timeoutMs);
+    char* getSymbol() { return _symbol; }
+    void applyTick(double price, time_t when, double dayHigh, double dayLow, double previousClose);
+    void attachIndicators(IntradayIndicators* ind);
+    void refreshIndicators(int from);
+    IntradayIndicators* indicators;  // Optional; only the graphed symbol carries one.
     double openPrice;
     double regularMarketPrice;
     double regularMarketDayHigh;
@@ -19,13 +46,28 @@ class YahooFin
     double regularMarketChangePercent;
     double regularMarketChange;
     double regularMarketPreviousClose;
-    double minuteQuotes[195];
+    double minuteQuotes[MAX_MINUTE_QUOTES];
+    float minuteVolumes[MAX_MINUTE_QUOTES];
+    uint32_t minuteTimes[MAX_MINUTE_QUOTES];  // Bar start, epoch seconds.
     int minuteDataPoints;
+    time_t firstBarTime; // minuteTimes[0]
+    time_t lastBarTime;  // minuteTimes[minuteDataPoints - 1]
+    time_t volumeGapFrom; // First bar with no real volume yet (built from ticks); 0 if none.
     time_t lastUpdateTime;
+    time_t lastChartTime;
+    int lastWireBytes;          // Body bytes received for the last fetch, compressed if gzip.
+    unsigned long lastFetchMs;  // Request to parsed, for the last fetch.
     bool lastUpdateOfDayDone;
+    bool quoteStale;    // Last quote fetch failed or was refused; the values are cached.
+    bool chartStale;    // Same for the intraday series.
+    bool fetchPending;  // Owned by QuoteFetcher. Set while a worker holds this object.
     
   private:
+    // The series began with a tick, so nothing before it has been fetched yet.
+    bool startedByTicks() { return volumeGapFrom != 0 && volumeGapFrom <= firstBarTime; }
+    bool fetchJson(const char* url, JsonDocument& doc, JsonDocument& filter, EndpointHealth& health);
     char* _symbol;
+    uint16_t _timeoutMs;
 };
 
 #endif
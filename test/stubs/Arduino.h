@@ -0,0 +1,63 @@
+// Just enough of the Arduino core for the native test env to build the modules listed in
+// its build_src_filter. Time is fake: tests set it with setMillis().
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+typedef uint8_t byte;
+using std::min;
+using std::max;
+
+inline unsigned long& fakeMillis() { static unsigned long ms = 0; return ms; }
+inline unsigned long millis() { return fakeMillis(); }
+inline unsigned long micros() { return fakeMillis() * 1000; }
+inline void setMillis(unsigned long ms) { fakeMillis() = ms; }
+inline void delay(unsigned long ms) { fakeMillis() += ms; }
+
+// As the ESP32 core has them.
+inline long map(long x, long inMin, long inMax, long outMin, long outMax)
+{
+  if (inMax == inMin) return -1;
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// Deterministic, so backoff jitter can be checked against its bounds.
+inline uint32_t esp_random() { static uint32_t x = 2463534242u; x ^= x << 13; x ^= x >> 17; x ^= x << 5; return x; }
+
+// Print and Stream folded into one; only what the firmware's writers call.
+class Stream
+{
+  public:
+    virtual ~Stream() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buf, size_t len)
+    {
+      for (size_t i = 0; i < len; i++) write(buf[i]);
+      return len;
+    }
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+};
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+// Silent, but the format still gets checked against its arguments.
+#define ESP_LOG_STUB(tag, format, ...) do { if (0) printf(format, ##__VA_ARGS__); } while (0)
+#define ESP_LOGE ESP_LOG_STUB
+#define ESP_LOGW ESP_LOG_STUB
+#define ESP_LOGI ESP_LOG_STUB
+#define ESP_LOGD ESP_LOG_STUB
+#define ESP_LOGV ESP_LOG_STUB
+
+#endif
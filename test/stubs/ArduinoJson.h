@@ -0,0 +1,7 @@
+// Declarations only: enough for headers that mention JsonDocument, not for parsing.
+#ifndef ArduinoJson_h
+#define ArduinoJson_h
+
+class JsonDocument;
+
+#endif
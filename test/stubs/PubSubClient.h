@@ -0,0 +1,23 @@
+// Keeps the last message published, for tests to look at.
+#ifndef PubSubClient_h
+#define PubSubClient_h
+
+#include "Arduino.h"
+
+class PubSubClient
+{
+  public:
+    PubSubClient() { topic[0] = 0; payload[0] = 0; }
+    bool publish(const char* t, const char* p) { return publish(t, p, false); }
+    bool publish(const char* t, const char* p, bool retained)
+    {
+      snprintf(topic, sizeof(topic), "%s", t);
+      snprintf(payload, sizeof(payload), "%s", p);
+      (void)retained;
+      return true;
+    }
+    char topic[128];
+    char payload[1024];
+};
+
+#endif
@@ -0,0 +1,207 @@
+// EndpointHealth's circuit breaker on fake time. pio test -e native -f test_endpoint_health
+#include <unity.h>
+#include "EndpointHealth.h"
+
+#define BASE_MS 1000
+#define MAX_MS 8000
+#define TRIP_AFTER 3
+
+void setUp() { setMillis(100000); }
+void tearDown() {}
+
+static void advance(unsigned long ms) { setMillis(millis() + ms); }
+
+static void trip(EndpointHealth& h)
+{
+  for (int i = 0; i < TRIP_AFTER; i++) {
+    TEST_ASSERT_TRUE(h.allow());
+    h.failure(10, 0);
+  }
+  TEST_ASSERT_EQUAL(CIRCUIT_OPEN, h.state());
+}
+
+// Steps time until the open circuit lets a probe through; returns how long that took.
+static unsigned long waitForProbe(EndpointHealth& h)
+{
+  unsigned long waited = 0;
+  while (!h.allow()) {
+    advance(10);
+    waited += 10;
+    if (waited > 10 * MAX_MS) break;
+  }
+  return waited;
+}
+
+static void test_trips_after_consecutive_failures()
+{
+  EndpointHealth h("t", 1000, BASE_MS, MAX_MS, TRIP_AFTER);
+  for (int i = 0; i < TRIP_AFTER - 1; i++) {
+    TEST_ASSERT_TRUE(h.allow());
+    h.failure(10, 0);
+  }
+  TEST_ASSERT_TRUE(h.allow());
+  h.success();  // Breaks the run.
+  for (int i = 0; i < TRIP_AFTER - 1; i++) {
+    TEST_ASSERT_TRUE(h.allow());
+    h.failure(10, 0);
+  }
+  TEST_ASSERT_EQUAL(CIRCUIT_CLOSED, h.state());
+  h.allow();
+  h.failure(10, 0);
+  TEST_ASSERT_EQUAL(CIRCUIT_OPEN, h.state());
+  TEST_ASSERT_EQUAL(TRIP_AFTER * 2 - 1, h.failures);
+  TEST_ASSERT_EQUAL(10 * (TRIP_AFTER * 2 - 1), h.blockedMs);
+}
+
+static void test_half_open_admits_one_probe()
+{
+  EndpointHealth h("t", 1000, BASE_MS, MAX_MS, TRIP_AFTER);
+  trip(h);
+  TEST_ASSERT_FALSE(h.allow());
+  unsigned long waited = waitForProbe(h);
+  TEST_ASSERT_TRUE(waited >= BASE_MS && waited <= BASE_MS * 3 / 2 + 10);
+  TEST_ASSERT_EQUAL(CIRCUIT_HALF_OPEN, h.state());
+  TEST_ASSERT_FALSE(h.allow());  // Everyone else waits on the probe.
+  TEST_ASSERT_FALSE(h.allow());
+  h.success();
+  TEST_ASSERT_EQUAL(CIRCUIT_CLOSED, h.state());
+  TEST_ASSERT_TRUE(h.allow());
+}
+
+static void test_backoff_doubles_to_cap_and_resets()
+{
+  EndpointHealth h("t", 1000, BASE_MS, MAX_MS, TRIP_AFTER);
+  trip(h);
+  unsigned long base = BASE_MS;
+  for (int i = 0; i < 6; i++) {
+    unsigned long waited = waitForProbe(h);
+    TEST_ASSERT_TRUE(waited >= base && waited <= base * 3 / 2 + 10);
+    h.failure(10, 0);  // The probe fails: straight back to open, next step up.
+    TEST_ASSERT_EQUAL(CIRCUIT_OPEN, h.state());
+    base = base * 2 > MAX_MS ? MAX_MS : base * 2;
+  }
+  waitForProbe(h);
+  h.success();
+  trip(h);
+  unsigned long waited = waitForProbe(h);
+  TEST_ASSERT_TRUE(waited >= BASE_MS && waited <= BASE_MS * 3 / 2 + 10);
+}
+
+static void test_retry_after_is_a_floor()
+{
+  EndpointHealth h("t", 1000, BASE_MS, MAX_MS, 1);
+  TEST_ASSERT_TRUE(h.allow());
+  h.failure(10, 30);
+  TEST_ASSERT_TRUE(waitForProbe(h) >= 30000);
+}
+
+// A probe that comes to nothing on our side (no heap, say) must not leave the circuit
+// half-open, or nobody gets to fetch again.
+static void test_release_hands_the_probe_back()
+{
+  EndpointHealth h("t", 1000, BASE_MS, MAX_MS, TRIP_AFTER);
+  h.release();  // Closed: no effect.
+  TEST_ASSERT_EQUAL(CIRCUIT_CLOSED, h.state());
+
+  trip(h);
+  waitForProbe(h);
+  h.release();
+  TEST_ASSERT_EQUAL(CIRCUIT_OPEN, h.state());
+  TEST_ASSERT_TRUE(h.allow());  // Backoff already served; the next caller probes.
+  TEST_ASSERT_EQUAL(CIRCUIT_HALF_OPEN, h.state());
+  unsigned long failures = h.failures;
+  h.release();
+  TEST_ASSERT_EQUAL(failures, h.failures);  // Counted neither way.
+}
+
+// Random outcomes, as fetchJson's exit paths produce them. Whatever happens, the circuit
+// must let a request through again within the longest backoff.
+static void test_never_stuck()
+{
+  EndpointHealth h("t", 1000, BASE_MS, MAX_MS, TRIP_AFTER);
+  srand(7);
+  for (int i = 0; i < 5000; i++) {
+    if (!h.allow()) {
+      advance(rand() % 2000);
+      continue;
+    }
+    switch (rand() % 3) {
+      case 0: h.success(); break;
+      case 1: h.failure(10, rand() % 4 == 0 ? 5 : 0); break;
+      case 2: h.release(); break;
+    }
+    advance(rand() % 500);
+    if (i % 50 == 0) {
+      TEST_ASSERT_TRUE(waitForProbe(h) <= MAX_MS * 3 / 2 + 10);
+      h.release();
+    }
+  }
+}
+
+// An outage as one worker sees it: every call hangs for the full timeout and fails. The
+// time lost has to stay within tripAfter timeouts to open the circuit, then one timeout
+// per probe, and probes come no faster than the base backoff. Once the endpoint is back
+// the circuit has to close within the longest backoff.
+static void test_outage_blocked_time_is_bounded()
+{
+  const unsigned long timeout = 1000;
+  const unsigned long outages[] = { 2500, 30000, 120000, 600000 };
+  for (unsigned o = 0; o < sizeof(outages) / sizeof(outages[0]); o++) {
+    unsigned long outage = outages[o];
+    EndpointHealth h("t", timeout, BASE_MS, MAX_MS, TRIP_AFTER);
+    unsigned long begin = millis();
+    unsigned long recoveredAt = 0;
+    while (!recoveredAt) {
+      if (!h.allow()) {
+        advance(50);
+      }
+      else if (millis() - begin < outage) {
+        advance(timeout);
+        h.failure(timeout, 0);
+      }
+      else {
+        advance(20);
+        h.success();
+        recoveredAt = millis();
+      }
+      TEST_ASSERT_TRUE(millis() - begin < outage + 10 * MAX_MS);
+    }
+
+    unsigned long bound = TRIP_AFTER * timeout + (outage + BASE_MS - 1) / BASE_MS * timeout;
+    char msg[96];
+    snprintf(msg, sizeof(msg), "outage %lums: blocked %lums of %lums allowed, back after %lums",
+             outage, h.blockedMs, bound, recoveredAt - begin - outage);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_TRUE(h.blockedMs <= bound);
+    TEST_ASSERT_TRUE(recoveredAt - begin - outage <= MAX_MS * 3 / 2 + timeout + 50);
+    TEST_ASSERT_EQUAL(CIRCUIT_CLOSED, h.state());
+  }
+}
+
+static void test_report_window()
+{
+  EndpointHealth h("t", 1000, BASE_MS, MAX_MS, TRIP_AFTER);
+  PubSubClient mqtt;
+  h.fetched(1000, true, 200);
+  h.fetched(-1, false, 400);
+  h.report(mqtt, "stat/test");
+  TEST_ASSERT_EQUAL_STRING("stat/test", mqtt.topic);
+  TEST_ASSERT_NOT_NULL(strstr(mqtt.payload, "\"state\":\"closed\""));
+  TEST_ASSERT_NOT_NULL(strstr(mqtt.payload, "\"fetches\":2,\"gzip\":1,\"avgBytes\":1000,\"avgMs\":300,\"maxMs\":400"));
+  h.report(mqtt, "stat/test");
+  TEST_ASSERT_NOT_NULL(strstr(mqtt.payload, "\"fetches\":0,\"gzip\":0,\"avgBytes\":0,\"avgMs\":0,\"maxMs\":0"));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_trips_after_consecutive_failures);
+  RUN_TEST(test_half_open_admits_one_probe);
+  RUN_TEST(test_backoff_doubles_to_cap_and_resets);
+  RUN_TEST(test_retry_after_is_a_floor);
+  RUN_TEST(test_release_hands_the_probe_back);
+  RUN_TEST(test_never_stuck);
+  RUN_TEST(test_outage_blocked_time_is_bounded);
+  RUN_TEST(test_report_window);
+  return UNITY_END();
+}
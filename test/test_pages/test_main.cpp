@@ -0,0 +1,268 @@
+// Page 0 and page 2 refreshes drawn through NexUI into the Nextion emulator, checked against
+// what ends up on the panel. pio test -e native -f test_pages, or make -C tools/nexemu test.
+// Run from the project root, where the layout is.
+#include <unity.h>
+#include "NexEmulator.h"
+#include "NexStream.h"
+#include "NexUI.h"
+#include "QuoteView.h"
+
+#ifndef NEXEMU_LAYOUT
+#define NEXEMU_LAYOUT "tools/nexemu/ccdesk.layout"
+#endif
+
+// YahooFin.cpp is all HTTP; the views only read its fields.
+YahooFin::YahooFin(char* symbol)
+{
+  _symbol = symbol;
+  _timeoutMs = 0;
+  indicators = NULL;
+  openPrice = regularMarketPrice = regularMarketDayHigh = regularMarketDayLow = 0;
+  regularMarketChangePercent = regularMarketChange = regularMarketPreviousClose = 0;
+  minuteDataPoints = 0;
+  firstBarTime = lastBarTime = volumeGapFrom = lastUpdateTime = lastChartTime = 0;
+  lastWireBytes = -1;
+  lastFetchMs = 0;
+  lastUpdateOfDayDone = quoteStale = chartStale = fetchPending = false;
+}
+
+static NexEmulator* nex;
+static NexStream* stream;
+static NexUI* nexUI;
+
+static void quote(YahooFin& yf, double price, double previousClose)
+{
+  yf.regularMarketPrice = price;
+  yf.regularMarketPreviousClose = previousClose;
+  yf.regularMarketChange = price - previousClose;
+  yf.regularMarketChangePercent = price / previousClose - 1;
+  yf.regularMarketDayHigh = price > previousClose ? price + 1 : previousClose + 1;
+  yf.regularMarketDayLow = price < previousClose ? price - 1 : previousClose - 1;
+}
+
+// A full day drifting from previousClose to the price.
+static void series(YahooFin& yf, IntradayIndicators* ind)
+{
+  for (int i = 0; i < MAX_MINUTE_QUOTES; i++) {
+    double t = (double)i / (MAX_MINUTE_QUOTES - 1);
+    yf.minuteQuotes[i] = yf.regularMarketPreviousClose + t * yf.regularMarketChange + ((i % 7) - 3) * 0.1;
+    yf.minuteVolumes[i] = 1000 + 10 * i;
+    yf.minuteTimes[i] = 1697549400 + i * CHART_INTERVAL_SECS;
+  }
+  yf.minuteDataPoints = MAX_MINUTE_QUOTES;
+  yf.indicators = ind;
+  for (int i = 0; ind && i < yf.minuteDataPoints; i++) ind->addBar(yf.minuteQuotes[i], yf.minuteVolumes[i]);
+}
+
+static void command(const char* cmd)
+{
+  nexUI->command(cmd);
+  nex->waitIdle();
+}
+
+static const NexObject* object(const char* page, const char* name)
+{
+  return nex->find(nex->pageIndex(page), name);
+}
+
+// -1 if never set, -2 if there's no such object.
+static long num(const char* page, const char* name, const char* attr)
+{
+  const NexObject* o = object(page, name);
+  if (!o) return -2;
+  auto it = o->num.find(attr);
+  return it == o->num.end() ? -1 : it->second;
+}
+
+static std::string text(const char* page, const char* name)
+{
+  const NexObject* o = object(page, name);
+  if (!o) return "(no such object)";
+  auto it = o->text.find("txt");
+  return it == o->text.end() ? "" : it->second;
+}
+
+void setUp()
+{
+  nex = new NexEmulator(480, 320);
+  TEST_ASSERT_TRUE(nex->loadLayout(NEXEMU_LAYOUT));
+  stream = new NexStream(*nex);
+  nexUI = new NexUI(*stream);
+}
+
+void tearDown()
+{
+  delete nexUI;
+  delete stream;
+  delete nex;
+}
+
+static void test_home_refresh()
+{
+  char acnSym[] = "ACN", spSym[] = "^GSPC", nasSym[] = "^IXIC";
+  YahooFin acn(acnSym), sp(spSym), nas(nasSym);
+  quote(acn, 301.22, 303.32);
+  quote(sp, 4783.45, 4771.15);
+  quote(nas, 15011.35, 15011.35);
+  nas.quoteStale = true;
+
+  command("page 0");
+  {
+    NexPageScope shown(*nexUI, 0);  // As showQuote() does.
+    drawQuoteLine(*nexUI, acn, ui::tAcn, true);
+    drawQuoteLine(*nexUI, sp, ui::tSP, true);
+    drawQuoteLine(*nexUI, nas, ui::tNAS, false);
+  }
+  nex->waitIdle();
+
+  TEST_ASSERT_EQUAL(0, nex->errors);
+  TEST_ASSERT_EQUAL(0, nex->bytesDropped);
+  TEST_ASSERT_EQUAL_STRING("tAcn.txt=\"$301.22($-2.10/-0.69%)\"", nex->log[1].text.c_str());  // Bare on its own page.
+  TEST_ASSERT_EQUAL(2, nexUI->savedBytes);  // RED for 63488 on tAcn; nothing else to save.
+  TEST_ASSERT_EQUAL_STRING("$301.22($-2.10/-0.69%)", text("page0", "tAcn").c_str());
+  TEST_ASSERT_EQUAL(ui::down.value, num("page0", "tAcn", "pco"));
+  TEST_ASSERT_EQUAL_STRING("$4783.45($12.30/0.26%)", text("page0", "tSP").c_str());
+  TEST_ASSERT_EQUAL(ui::up.value, num("page0", "tSP", "pco"));
+  TEST_ASSERT_EQUAL_STRING("$15011.35", text("page0", "tNAS").c_str());
+  TEST_ASSERT_EQUAL(ui::stale.value, num("page0", "tNAS", "pco"));
+}
+
+// A write that lands after the panel has moved on (an MQTT callback, a late fetch) still
+// has to reach its own page and nothing on the one showing.
+static void test_write_from_another_page()
+{
+  char acnSym[] = "ACN";
+  YahooFin acn(acnSym);
+  quote(acn, 310, 300);
+
+  command("page 2");
+  drawQuoteLine(*nexUI, acn, ui::tAcn, true);
+  nex->waitIdle();
+
+  TEST_ASSERT_EQUAL(0, nex->errors);
+  TEST_ASSERT_EQUAL(2, nex->currentPage);
+  TEST_ASSERT_EQUAL_STRING("$310.00($10.00/3.33%)", text("page0", "tAcn").c_str());
+  TEST_ASSERT_EQUAL_STRING("", text("page2", "t1").c_str());
+  TEST_ASSERT_EQUAL(-2 * (int)strlen("page0."), nexUI->savedBytes);  // Qualified costs more; up has no name.
+}
+
+static void test_graph_refresh()
+{
+  char acnSym[] = "ACN";
+  YahooFin acn(acnSym);
+  quote(acn, 305.5, 300.25);
+  series(acn, NULL);
+
+  command("page 2");
+  NexPageScope shown(*nexUI, 2);  // As drawGraph() does.
+  uint64_t start = nex->nowUs();
+  TEST_ASSERT_TRUE(drawGraphPage(*nexUI, acn, false));
+  nex->waitIdle();
+
+  TEST_ASSERT_EQUAL(0, nex->errors);
+  TEST_ASSERT_EQUAL(0, nex->bytesDropped);
+  TEST_ASSERT_EQUAL_STRING("305.50(5.25/1.75%)", text("page2", "t1").c_str());
+  TEST_ASSERT_EQUAL(ui::up.value, num("page2", "t1", "pco"));
+  TEST_ASSERT_EQUAL(ui::up.value, num("page2", "s0", "pco0"));
+
+  // Two points for two bars in three.
+  int points = 0;
+  for (int i = 0; i < MAX_MINUTE_QUOTES; i++) points += (i % 3) ? 2 : 1;
+  const NexObject* s0 = object("page2", "s0");
+  TEST_ASSERT_NOT_NULL(s0);
+  TEST_ASSERT_TRUE(s0->wave.size() >= 2);
+  TEST_ASSERT_EQUAL(points, s0->wave[0].size());
+  TEST_ASSERT_EQUAL(points, s0->wave[1].size());
+  for (size_t c = 2; c < s0->wave.size(); c++) TEST_ASSERT_EQUAL(0, s0->wave[c].size());
+  TEST_ASSERT_TRUE(s0->wave[0].front() < s0->wave[0].back());  // Drifted up.
+  TEST_ASSERT_EQUAL(s0->wave[1].front(), s0->wave[1].back());   // Previous close is flat.
+  TEST_ASSERT_EQUAL(3, nex->overlays.size());                 // High, low, previous close labels.
+
+  char msg[80];
+  snprintf(msg, sizeof(msg), "page 2 refresh: %u commands, panel busy %.1f ms", (unsigned)nex->log.size(), (nex->idleAtUs() - start) / 1000.0);
+  TEST_MESSAGE(msg);
+
+  // Redrawn, the waveform starts over rather than appending.
+  TEST_ASSERT_TRUE(drawGraphPage(*nexUI, acn, false));
+  nex->waitIdle();
+  TEST_ASSERT_EQUAL(points, s0->wave[0].size());
+}
+
+static void test_graph_overlays()
+{
+  char acnSym[] = "ACN";
+  YahooFin acn(acnSym);
+  IntradayIndicators ind(20, 9);
+  quote(acn, 295.75, 300.25);
+  acn.chartStale = true;
+  series(acn, &ind);
+
+  command("page 2");
+  TEST_ASSERT_TRUE(drawGraphPage(*nexUI, acn, true));
+  nex->waitIdle();
+
+  TEST_ASSERT_EQUAL(0, nex->errors);
+  TEST_ASSERT_EQUAL(ui::down.value, num("page2", "t1", "pco"));
+  TEST_ASSERT_EQUAL(ui::stale.value, num("page2", "s0", "pco0"));
+  const NexObject* s0 = object("page2", "s0");
+  TEST_ASSERT_NOT_NULL(s0);
+  TEST_ASSERT_EQUAL(4, s0->wave.size());
+  TEST_ASSERT_EQUAL(s0->wave[0].size(), s0->wave[GRAPH_CH_VWAP].size());
+  TEST_ASSERT_EQUAL(s0->wave[0].size(), s0->wave[GRAPH_CH_MA].size());
+}
+
+// With indicators attached the high and low labels come from their running min/max rather
+// than a scan of the series; they have to land in the same place.
+static void test_graph_labels_from_indicators()
+{
+  char acnSym[] = "ACN";
+  YahooFin acn(acnSym);
+  IntradayIndicators ind(20, 9);
+  quote(acn, 305.5, 300.25);
+  series(acn, NULL);
+
+  command("page 2");
+  TEST_ASSERT_TRUE(drawGraphPage(*nexUI, acn, false));
+  nex->waitIdle();
+  std::vector<NexOverlay> scanned = nex->overlays;
+
+  series(acn, &ind);
+  command("page 2");
+  TEST_ASSERT_TRUE(drawGraphPage(*nexUI, acn, false));
+  nex->waitIdle();
+
+  TEST_ASSERT_EQUAL(0, nex->errors);
+  TEST_ASSERT_EQUAL(3, scanned.size());
+  TEST_ASSERT_EQUAL(3, nex->overlays.size());
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_EQUAL(scanned[i].x, nex->overlays[i].x);
+    TEST_ASSERT_EQUAL(scanned[i].y, nex->overlays[i].y);
+    TEST_ASSERT_EQUAL_STRING(scanned[i].text.c_str(), nex->overlays[i].text.c_str());
+  }
+}
+
+static void test_graph_without_series()
+{
+  char acnSym[] = "ACN";
+  YahooFin acn(acnSym);
+  quote(acn, 305.5, 300.25);
+
+  command("page 2");
+  TEST_ASSERT_FALSE(drawGraphPage(*nexUI, acn, true));
+  nex->waitIdle();
+  TEST_ASSERT_EQUAL(0, nex->errors);
+  TEST_ASSERT_EQUAL_STRING("305.50(5.25/1.75%)", text("page2", "t1").c_str());
+  TEST_ASSERT_EQUAL(0, nex->overlays.size());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_home_refresh);
+  RUN_TEST(test_write_from_another_page);
+  RUN_TEST(test_graph_refresh);
+  RUN_TEST(test_graph_overlays);
+  RUN_TEST(test_graph_labels_from_indicators);
+  RUN_TEST(test_graph_without_series);
+  return UNITY_END();
+}
@@ -0,0 +1,96 @@
+// PricingData decode, base64 through protobuf. pio test -e native -f test_pricing
+#include <unity.h>
+#include <string.h>
+#include "PricingData.h"
+
+// BTC-USD as sent by the streamer, from the public examples of its protocol. Carries most
+// fields, including the ones we skip, but no previous close.
+static const char* btcFrame =
+  "CgdCVEMtVVNEFYoMuUYYwLCVgIplIgNVU0QqA0NDQzApOAFFPWrEP0iAgOrxvANVPbbMRl2whshGZYBIaURqC0JpdGNvaW4gVVNE"
+  "sAGAgOrxvAPYAQTgAYCA6vG8A+gBgIDq8bwD8gEDQlRD+gENQ29pbkNvbnV0IFVTRA==";
+
+// ACN laid out the same way, with previous close (16) and a fixed64 field (40) thrown in.
+static const char* acnFrame = "CgNBQ04VAKCWQxiA36Hd52IiA1VTRDgBRdejML9Ih61LVQBAmENdAOCVQ2VmZgbAhQHNrJdDwQIAAAAAAADwPw==";
+
+void setUp() {}
+void tearDown() {}
+
+static void test_btc_frame()
+{
+  PricingTick t;
+  TEST_ASSERT_TRUE(decodePricingBase64(btcFrame, strlen(btcFrame), &t));
+  TEST_ASSERT_EQUAL_STRING("BTC-USD", t.id);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 23686.27, t.price);
+  TEST_ASSERT_TRUE(t.timeMs == 1736509140000LL);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 26203.12, t.dayHigh);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 25667.34, t.dayLow);
+  TEST_ASSERT_TRUE(t.previousClose == 0);
+}
+
+static void test_acn_frame()
+{
+  PricingTick t;
+  TEST_ASSERT_TRUE(decodePricingBase64(acnFrame, strlen(acnFrame), &t));
+  TEST_ASSERT_EQUAL_STRING("ACN", t.id);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 301.25, t.price);
+  TEST_ASSERT_TRUE(t.timeMs == 1697549400000LL);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 304.5, t.dayHigh);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 299.75, t.dayLow);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 303.35, t.previousClose);
+}
+
+static void test_base64()
+{
+  uint8_t out[8];
+  size_t n;
+  TEST_ASSERT_TRUE(base64Decode("TWFu", 4, out, sizeof(out), &n));
+  TEST_ASSERT_EQUAL(3, n);
+  TEST_ASSERT_EQUAL(0, memcmp(out, "Man", 3));
+  TEST_ASSERT_TRUE(base64Decode("TWE=", 4, out, sizeof(out), &n));
+  TEST_ASSERT_EQUAL(2, n);
+  TEST_ASSERT_TRUE(base64Decode("TQ", 2, out, sizeof(out), &n));  // Unpadded.
+  TEST_ASSERT_EQUAL(1, n);
+  TEST_ASSERT_EQUAL('M', out[0]);
+
+  TEST_ASSERT_FALSE(base64Decode("TW!u", 4, out, sizeof(out), &n));
+  TEST_ASSERT_FALSE(base64Decode("TWFuT", 5, out, sizeof(out), &n));
+  TEST_ASSERT_FALSE(base64Decode("TWFuTWFuTWFu", 12, out, sizeof(out), &n));  // 9 bytes into 8.
+}
+
+static void test_malformed()
+{
+  PricingTick t;
+  uint8_t buf[PRICING_MAX_BYTES];
+  size_t n;
+  TEST_ASSERT_TRUE(base64Decode(acnFrame, strlen(acnFrame), buf, sizeof(buf), &n));
+
+  // A cut on a field boundary is a valid, shorter message. Anywhere else has to fail
+  // rather than read past the end.
+  TEST_ASSERT_TRUE(decodePricing(buf, 5, &t));  // Just the id.
+  TEST_ASSERT_EQUAL_STRING("ACN", t.id);
+  TEST_ASSERT_TRUE(t.price == 0);
+  TEST_ASSERT_FALSE(decodePricing(buf, 3, &t));      // Inside the id.
+  TEST_ASSERT_FALSE(decodePricing(buf, 7, &t));      // Inside the price.
+  TEST_ASSERT_FALSE(decodePricing(buf, 13, &t));     // Inside the time varint.
+  TEST_ASSERT_FALSE(decodePricing(buf, n - 3, &t));  // Inside the fixed64.
+
+  const uint8_t badWireType[] = { 0x0B, 0x00 };  // Field 1, wire type 3.
+  TEST_ASSERT_FALSE(decodePricing(badWireType, sizeof(badWireType), &t));
+  const uint8_t longString[] = { 0x0A, 0x7F, 'A' };  // Length past the end.
+  TEST_ASSERT_FALSE(decodePricing(longString, sizeof(longString), &t));
+  const uint8_t longId[] = { 0x0A, 0x14, 'A','B','C','D','E','F','G','H','I','J','K','L','M','N','O','P','Q','R','S','T' };
+  TEST_ASSERT_TRUE(decodePricing(longId, sizeof(longId), &t));
+  TEST_ASSERT_EQUAL_STRING("ABCDEFGHIJKLMNO", t.id);  // Truncated, not overrun.
+
+  TEST_ASSERT_FALSE(decodePricingBase64("not base64!", 11, &t));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_btc_frame);
+  RUN_TEST(test_acn_frame);
+  RUN_TEST(test_base64);
+  RUN_TEST(test_malformed);
+  return UNITY_END();
+}
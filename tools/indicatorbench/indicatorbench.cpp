@@ -0,0 +1,156 @@
+// Times IntradayIndicators against recomputing everything over the series, and checks that
+// the two agree, including after a re-feed like the one getChart does when tick-built bars
+// get their volume.
+//
+//   g++ -std=c++11 -O2 -Isrc -o indicatorbench tools/indicatorbench/indicatorbench.cpp src/IntradayIndicators.cpp
+//   indicatorbench [iterations]
+//
+// On the host (x86-64, g++ 12.2 -O2, default 20000 iterations, best of 3 runs):
+//   updateLastBar        23 ns
+//   addBar               25 ns
+//   re-feed 195 bars    4.8 us
+//   brute force, 1 bar  1.25 us   (every indicator over the whole series, per tick)
+// So a tick costs about 1/50 of recomputing, and a full re-feed about four recomputes; it
+// happens once per chart fetch at most. Not measured on the ESP32 itself.
+
+#include "IntradayIndicators.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+
+#define BARS INDICATOR_MAX_BARS
+#define SMA_PERIOD 20
+#define EMA_PERIOD 9
+
+static double closes[BARS];
+static double volumes[BARS];
+
+struct Brute
+{
+  double vwap, sma, ema, minClose, maxClose;
+};
+
+// Everything from scratch over bars [0, n).
+static Brute brute(int n)
+{
+  Brute b;
+  double pv = 0, v = 0, ema = 0, alpha = 2.0 / (EMA_PERIOD + 1);
+  b.minClose = b.maxClose = closes[0];
+  for (int i = 0; i < n; i++) {
+    pv += closes[i] * volumes[i];
+    v += volumes[i];
+    ema = i == 0 ? closes[i] : alpha * closes[i] + (1 - alpha) * ema;
+    if (closes[i] < b.minClose) b.minClose = closes[i];
+    if (closes[i] > b.maxClose) b.maxClose = closes[i];
+  }
+  int from = n > SMA_PERIOD ? n - SMA_PERIOD : 0;
+  double sum = 0;
+  for (int i = from; i < n; i++) sum += closes[i];
+  b.vwap = v > 0 ? pv / v : closes[n - 1];
+  b.sma = sum / (n - from);
+  b.ema = ema;
+  return b;
+}
+
+static bool near(double a, double b)
+{
+  return fabs(a - b) <= 1e-3 * fabs(b) + 1e-6;
+}
+
+static int check(IntradayIndicators& ind, const char* when)
+{
+  int i = ind.count - 1;
+  Brute b = brute(ind.count);
+  if (near(ind.vwap[i], b.vwap) && near(ind.sma[i], b.sma) && near(ind.ema[i], b.ema) &&
+      ind.minClose() == b.minClose && ind.maxClose() == b.maxClose) return 0;
+  fprintf(stderr, "mismatch %s at bar %d: vwap %f/%f sma %f/%f ema %f/%f min %f/%f max %f/%f\n", when, i,
+          ind.vwap[i], b.vwap, ind.sma[i], b.sma, ind.ema[i], b.ema, ind.minClose(), b.minClose, ind.maxClose(), b.maxClose);
+  return 1;
+}
+
+static void feed(IntradayIndicators& ind, int n)
+{
+  ind.reset();
+  for (int i = 0; i < n; i++) ind.addBar(closes[i], volumes[i]);
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static double nsSince(Clock::time_point start, long ops)
+{
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ops;
+}
+
+int main(int argc, char** argv)
+{
+  long iterations = argc > 1 ? atol(argv[1]) : 20000;
+
+  srand(1);
+  double p = 300;
+  for (int i = 0; i < BARS; i++) {
+    p += (rand() % 201 - 100) / 100.0;
+    closes[i] = p;
+    volumes[i] = 1000 + rand() % 50000;
+  }
+
+  // Correctness: bar by bar with ticks revising the last one, then a day whose last 30 bars
+  // came from ticks (no volume) and are re-fed once the chart fills them in.
+  int failures = 0;
+  IntradayIndicators ind(SMA_PERIOD, EMA_PERIOD);
+  for (int i = 0; i < BARS; i++) {
+    double close = closes[i];
+    ind.addBar(close - 0.5, volumes[i] / 2);
+    closes[i] = close - 0.5;
+    double v = volumes[i];
+    volumes[i] /= 2;
+    failures += check(ind, "addBar");
+    closes[i] = close;
+    volumes[i] = v;
+    ind.updateLastBar(close, v);
+    failures += check(ind, "updateLastBar");
+  }
+
+  double saved[30];
+  for (int i = 0; i < 30; i++) {
+    saved[i] = volumes[BARS - 30 + i];
+    volumes[BARS - 30 + i] = 0;
+  }
+  feed(ind, BARS);
+  failures += check(ind, "tick bars");
+  for (int i = 0; i < 30; i++) volumes[BARS - 30 + i] = saved[i];
+  feed(ind, BARS);
+  failures += check(ind, "re-feed");
+
+  // Timing.
+  volatile double sink = 0;
+  Clock::time_point start = Clock::now();
+  for (long k = 0; k < iterations * BARS; k++) {
+    ind.updateLastBar(closes[k % BARS], volumes[k % BARS]);
+    sink += ind.ema[ind.count - 1];
+  }
+  double update = nsSince(start, iterations * BARS);
+
+  start = Clock::now();
+  for (long k = 0; k < iterations; k++) {
+    ind.reset();
+    for (int i = 0; i < BARS; i++) ind.addBar(closes[i], volumes[i]);
+    sink += ind.ema[BARS - 1];
+  }
+  double refeed = nsSince(start, iterations);
+  double add = refeed / BARS;
+
+  start = Clock::now();
+  for (long k = 0; k < iterations; k++) {
+    Brute b = brute(BARS - (k & 1));
+    sink += b.ema;
+  }
+  double bruteNs = nsSince(start, iterations);
+
+  printf("updateLastBar      %8.1f ns\n", update);
+  printf("addBar             %8.1f ns\n", add);
+  printf("re-feed %d bars   %8.1f ns\n", BARS, refeed);
+  printf("brute force, 1 bar %8.1f ns\n", bruteNs);
+  printf("%s\n", failures ? "MISMATCH" : "results match");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,693 @@
+#include "NexEmulator.h"
+#include "font5x7.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+// Nextion return codes.
+#define NEX_RET_INVALID_CMD 0x00
+#define NEX_RET_OK 0x01
+#define NEX_RET_INVALID_ID 0x02
+#define NEX_RET_INVALID_PAGE 0x03
+#define NEX_RET_INVALID_VAR 0x1A
+#define NEX_RET_INVALID_OP 0x1B
+#define NEX_RET_ASSIGN_FAILED 0x1C
+#define NEX_RET_PARAM_COUNT 0x1E
+#define NEX_RET_OVERFLOW 0x24
+#define NEX_RET_NUM 0x71
+#define NEX_RET_STR 0x70
+#define NEX_AUTO_WAKE 0x87
+
+#define NEX_WAVE_DEFAULT_POINTS 1024  // Kept per channel when the waveform has no width.
+
+static const struct { const char* name; long value; } nexConstants[] = {
+  { "BLACK", 0 }, { "BLUE", 31 }, { "GREEN", 2016 }, { "GRAY", 33840 },
+  { "BROWN", 48192 }, { "RED", 63488 }, { "YELLOW", 65504 }, { "WHITE", 65535 },
+};
+
+static const struct { const char* name; NexType type; } nexTypes[] = {
+  { "text", NEX_TEXT }, { "number", NEX_NUMBER }, { "button", NEX_BUTTON }, { "picture", NEX_PICTURE },
+  { "progress", NEX_PROGRESS }, { "waveform", NEX_WAVEFORM }, { "timer", NEX_TIMER }, { "variable", NEX_VARIABLE },
+};
+
+static std::string trim(const std::string& s)
+{
+  size_t a = s.find_first_not_of(" \t\r\n");
+  size_t b = s.find_last_not_of(" \t\r\n");
+  return a == std::string::npos ? "" : s.substr(a, b - a + 1);
+}
+
+static bool startsWith(const std::string& s, const char* prefix)
+{
+  return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+// A literal number or one of the built-in constants.
+static bool parseNumber(const std::string& s, long& out)
+{
+  std::string t = trim(s);
+  if (t.empty()) return false;
+  for (const auto& c : nexConstants) {
+    if (t == c.name) {
+      out = c.value;
+      return true;
+    }
+  }
+  char* end;
+  out = strtol(t.c_str(), &end, 10);
+  return *end == 0;
+}
+
+// Comma separated arguments; a quoted one may contain commas.
+static std::vector<std::string> splitArgs(const std::string& s)
+{
+  std::vector<std::string> args;
+  std::string cur;
+  bool quoted = false;
+  for (char c : s) {
+    if (c == '"') quoted = !quoted;
+    if (c == ',' && !quoted) {
+      args.push_back(trim(cur));
+      cur.clear();
+    }
+    else cur += c;
+  }
+  args.push_back(trim(cur));
+  return args;
+}
+
+static bool unquote(const std::string& s, std::string& out)
+{
+  std::string t = trim(s);
+  if (t.size() < 2 || t.front() != '"' || t.back() != '"') return false;
+  out = t.substr(1, t.size() - 2);
+  return true;
+}
+
+NexEmulator::NexEmulator(int width, int height, const NexTiming& timing)
+{
+  _width = width;
+  _height = height;
+  _timing = timing;
+  _strict = false;
+  _nowNs = 0;
+  _lineFreeNs = 0;
+  _busyNs = 0;
+  _stallNs = 0;
+  _ffs = 0;
+  _queuedBytes = 0;
+  currentPage = 0;
+  sleeping = false;
+  reportPages = true;
+  bytesIn = 0;
+  bytesDropped = 0;
+  errors = 0;
+  sysvars["dim"] = 100;
+  sysvars["bkcmd"] = 2;
+  sysvars["thup"] = 0;
+  sysvars["thsp"] = 0;
+}
+
+int NexEmulator::addPage(const std::string& name)
+{
+  NexPageState p;
+  p.name = name;
+  pages.push_back(p);
+  return pages.size() - 1;
+}
+
+NexObject& NexEmulator::addObject(int page, const std::string& name, NexType type, int id, int x, int y, int w, int h)
+{
+  while ((int)pages.size() <= page) addPage("page" + std::to_string(pages.size()));
+  NexObject o;
+  o.name = name;
+  o.type = type;
+  o.id = id;
+  o.x = x;
+  o.y = y;
+  o.w = w;
+  o.h = h;
+  o.num["pco"] = 65535;
+  o.num["bco"] = 0;
+  if (type == NEX_WAVEFORM) {
+    static const long channelColors[] = { 2016, 63488, 31, 65504 };
+    for (int ch = 0; ch < 4; ch++) o.num["pco" + std::to_string(ch)] = channelColors[ch];
+    o.wave.resize(1);
+  }
+  pages[page].objects.push_back(o);
+  return pages[page].objects.back();
+}
+
+// One declaration per line:
+//   page <name>
+//   obj <name> <type> <id> <x> <y> <w> <h> [attr=value ...]
+// Objects go on the page declared last. A waveform's channel count is ch=N.
+bool NexEmulator::loadLayout(const char* path)
+{
+  FILE* f = fopen(path, "r");
+  if (!f) return false;
+
+  char line[256];
+  int page = -1;
+  int lineNo = 0;
+  bool ok = true;
+  while (fgets(line, sizeof(line), f)) {
+    lineNo++;
+    std::string l = trim(line);
+    if (l.empty() || l[0] == '#') continue;
+
+    char word[16], name[32], type[16];
+    if (sscanf(l.c_str(), "page %31s", name) == 1) {
+      page = addPage(name);
+      continue;
+    }
+    int id, x, y, w, h, used = 0;
+    if (page < 0 || sscanf(l.c_str(), "%15s %31s %15s %d %d %d %d %d%n", word, name, type, &id, &x, &y, &w, &h, &used) < 8 || strcmp(word, "obj")) {
+      fprintf(stderr, "%s:%d: can't parse \"%s\"\n", path, lineNo, l.c_str());
+      ok = false;
+      continue;
+    }
+    NexType t = NEX_UNKNOWN;
+    for (const auto& nt : nexTypes) {
+      if (!strcmp(type, nt.name)) t = nt.type;
+    }
+    NexObject& o = addObject(page, name, t, id, x, y, w, h);
+
+    // Trailing attr=value defaults. Quoted values may hold spaces.
+    std::string rest = l.substr(used);
+    size_t i = 0;
+    while (i < rest.size()) {
+      while (i < rest.size() && rest[i] == ' ') i++;
+      size_t eq = rest.find('=', i);
+      if (eq == std::string::npos) break;
+      std::string attr = rest.substr(i, eq - i);
+      size_t end = eq + 1;
+      if (end < rest.size() && rest[end] == '"') end = rest.find('"', end + 1) + 1;
+      else end = rest.find(' ', end);
+      if (end == std::string::npos || end == 0) end = rest.size();
+      std::string value = rest.substr(eq + 1, end - eq - 1);
+      std::string s;
+      long v;
+      if (unquote(value, s)) o.text[attr] = s;
+      else if (attr == "ch" && parseNumber(value, v)) o.wave.resize(v);
+      else if (parseNumber(value, v)) o.num[attr] = v;
+      i = end;
+    }
+  }
+  fclose(f);
+  _strict = true;
+  return ok;
+}
+
+int NexEmulator::pageIndex(const std::string& name)
+{
+  for (size_t i = 0; i < pages.size(); i++) {
+    if (pages[i].name == name) return i;
+  }
+  return -1;
+}
+
+NexObject* NexEmulator::find(int page, const std::string& name)
+{
+  if (page < 0 || page >= (int)pages.size()) return NULL;
+  for (NexObject& o : pages[page].objects) {
+    if (o.name == name) return &o;
+  }
+  return NULL;
+}
+
+// Bytes leave the ESP32 one every 10 bit times. Only txFifoBytes can be waiting to go, so
+// beyond that the writer is held up until the wire catches up, as Serial2.write() would be.
+size_t NexEmulator::write(uint8_t c)
+{
+  uint64_t byteNs = 10000000000ULL / _timing.baud;
+  uint64_t fifoNs = _timing.txFifoBytes * byteNs;
+  if (_lineFreeNs > _nowNs + fifoNs) {
+    _stallNs += _lineFreeNs - fifoNs - _nowNs;
+    _nowNs = _lineFreeNs - fifoNs;
+  }
+  _lineFreeNs = std::max(_nowNs, _lineFreeNs) + byteNs;
+  uint64_t arrived = _lineFreeNs;
+  bytesIn++;
+
+  // Commands the panel has started on are out of its buffer.
+  while (!_queued.empty() && _queued.front().first <= arrived) {
+    _queuedBytes -= _queued.front().second;
+    _queued.pop_front();
+  }
+  if (_queuedBytes + _partial.size() + _ffs >= _timing.rxBufferBytes) {
+    bytesDropped++;
+    replyCode(arrived, NEX_RET_OVERFLOW);
+    return 1;
+  }
+
+  if (c == 0xFF) {
+    if (++_ffs == 3) {
+      size_t len = _partial.size() + 3;
+      std::string cmd;
+      cmd.swap(_partial);
+      _ffs = 0;
+      command(cmd, arrived, len);
+    }
+    return 1;
+  }
+  if (_ffs) _partial.append(_ffs, (char)0xFF);  // Not a terminator after all.
+  _ffs = 0;
+  _partial += (char)c;
+  return 1;
+}
+
+size_t NexEmulator::write(const uint8_t* buf, size_t len)
+{
+  for (size_t i = 0; i < len; i++) write(buf[i]);
+  return len;
+}
+
+int NexEmulator::available()
+{
+  int n = 0;
+  for (const auto& r : _replies) {
+    if (r.first > _nowNs) break;
+    n++;
+  }
+  return n;
+}
+
+int NexEmulator::read()
+{
+  if (_replies.empty() || _replies.front().first > _nowNs) return -1;
+  uint8_t c = _replies.front().second;
+  _replies.pop_front();
+  return c;
+}
+
+int NexEmulator::peek()
+{
+  if (_replies.empty() || _replies.front().first > _nowNs) return -1;
+  return _replies.front().second;
+}
+
+// Like HardwareSerial::flush(): returns once the last byte is on the wire.
+void NexEmulator::flush()
+{
+  if (_lineFreeNs > _nowNs) _nowNs = _lineFreeNs;
+}
+
+void NexEmulator::waitIdle()
+{
+  uint64_t idle = std::max(_busyNs, _lineFreeNs);
+  if (idle > _nowNs) _nowNs = idle;
+}
+
+void NexEmulator::reply(uint64_t atNs, const uint8_t* bytes, size_t len)
+{
+  // Replies can't overtake each other.
+  if (!_replies.empty() && _replies.back().first > atNs) atNs = _replies.back().first;
+  for (size_t i = 0; i < len; i++) _replies.push_back(std::make_pair(atNs, bytes[i]));
+}
+
+void NexEmulator::replyCode(uint64_t atNs, uint8_t code)
+{
+  uint8_t msg[] = { code, 0xFF, 0xFF, 0xFF };
+  reply(atNs, msg, sizeof(msg));
+}
+
+// The panel takes commands strictly in order, each once the previous is done.
+void NexEmulator::command(const std::string& cmd, uint64_t rxDoneNs, size_t len)
+{
+  uint64_t start = std::max(rxDoneNs, _busyNs);
+  uint8_t error = 0;
+  _out.clear();
+  uint64_t cost = (uint64_t)_timing.commandUs * 1000 + (uint64_t)_timing.perByteUs * 1000 * cmd.size() + execute(cmd, error);
+  uint64_t done = start + cost;
+  _busyNs = done;
+  _queued.push_back(std::make_pair(start, len));
+  _queuedBytes += len;
+
+  NexCommandRecord r = { cmd, rxDoneNs / 1000, start / 1000, done / 1000, error };
+  log.push_back(r);
+
+  if (!_out.empty()) reply(done, _out.data(), _out.size());
+  long bkcmd = sysvars["bkcmd"];
+  if (error) {
+    errors++;
+    if (bkcmd >= 2) replyCode(done, error);
+  }
+  else if (bkcmd == 1 || bkcmd == 3) replyCode(done, NEX_RET_OK);
+}
+
+uint64_t NexEmulator::redrawCost(const NexObject& o)
+{
+  if (o.w <= 0 || o.h <= 0 || o.type == NEX_TIMER || o.type == NEX_VARIABLE) return 0;
+  uint64_t cost = (uint64_t)o.w * o.h * _timing.pixelNs;
+  auto txt = o.text.find("txt");
+  if (txt != o.text.end()) cost += (uint64_t)txt->second.size() * _timing.glyphUs * 1000;
+  if (o.type == NEX_WAVEFORM) {
+    for (const auto& ch : o.wave) cost += (uint64_t)ch.size() * _timing.waveAddUs * 1000;
+  }
+  return cost;
+}
+
+uint64_t NexEmulator::pageCost()
+{
+  if (sleeping || currentPage < 0 || currentPage >= (int)pages.size()) return 0;
+  uint64_t cost = (uint64_t)_timing.pageUs * 1000;
+  for (const NexObject& o : pages[currentPage].objects) cost += redrawCost(o);
+  return cost;
+}
+
+uint64_t NexEmulator::execute(const std::string& raw, uint8_t& error)
+{
+  std::string cmd = trim(raw);
+
+  if (startsWith(cmd, "page ")) {
+    std::string arg = trim(cmd.substr(5));
+    long n;
+    int page = parseNumber(arg, n) ? (int)n : pageIndex(arg);
+    if (page < 0 || (_strict && page >= (int)pages.size())) {
+      error = NEX_RET_INVALID_PAGE;
+      return 0;
+    }
+    while ((int)pages.size() <= page) addPage("page" + std::to_string(pages.size()));
+    currentPage = page;
+    overlays.clear();
+    if (reportPages) {
+      uint8_t msg[] = { '#', 2, 'P', (uint8_t)page };
+      _out.insert(_out.end(), msg, msg + sizeof(msg));
+    }
+    return pageCost();
+  }
+
+  if (startsWith(cmd, "add ") || startsWith(cmd, "cle ")) {
+    bool add = cmd[0] == 'a';
+    std::vector<std::string> args = splitArgs(cmd.substr(4));
+    long id, ch, value = 0;
+    if (args.size() != (add ? 3u : 2u) || !parseNumber(args[0], id) || !parseNumber(args[1], ch) || (add && !parseNumber(args[2], value))) {
+      error = NEX_RET_PARAM_COUNT;
+      return 0;
+    }
+    NexObject* wave = NULL;
+    if (currentPage < (int)pages.size()) {
+      for (NexObject& o : pages[currentPage].objects) {
+        if (o.id == id && (o.type == NEX_WAVEFORM || (!_strict && o.type == NEX_UNKNOWN))) wave = &o;
+      }
+    }
+    if (!wave && !_strict) {
+      wave = &addObject(currentPage, "s" + std::to_string(id), NEX_WAVEFORM, id, 0, 0, 0, 0);
+    }
+    bool all = !add && ch == 255;
+    if (!wave || (!all && (ch < 0 || ch > 3 || (_strict && ch >= (long)wave->wave.size())))) {
+      error = NEX_RET_INVALID_ID;
+      return 0;
+    }
+    if (!all && ch >= (long)wave->wave.size()) wave->wave.resize(ch + 1);
+
+    if (!add) {
+      for (size_t c = 0; c < wave->wave.size(); c++) {
+        if (all || (long)c == ch) wave->wave[c].clear();
+      }
+      return sleeping ? 0 : (uint64_t)wave->w * wave->h * _timing.pixelNs;
+    }
+    std::vector<uint8_t>& data = wave->wave[ch];
+    data.push_back((uint8_t)std::min(255L, std::max(0L, value)));
+    size_t keep = wave->w > 0 ? wave->w : NEX_WAVE_DEFAULT_POINTS;
+    if (data.size() > keep) data.erase(data.begin(), data.begin() + (data.size() - keep));
+    return sleeping ? 0 : (uint64_t)_timing.waveAddUs * 1000;
+  }
+
+  if (startsWith(cmd, "xstr ")) {
+    std::vector<std::string> args = splitArgs(cmd.substr(5));
+    long v[10];
+    NexOverlay o;
+    if (args.size() != 11 || !unquote(args[10], o.text)) {
+      error = NEX_RET_PARAM_COUNT;
+      return 0;
+    }
+    for (int i = 0; i < 10; i++) {
+      if (!parseNumber(args[i], v[i])) {
+        error = NEX_RET_INVALID_OP;
+        return 0;
+      }
+    }
+    o.x = v[0];
+    o.y = v[1];
+    o.w = v[2];
+    o.h = v[3];
+    o.pco = v[5];
+    o.bco = v[6];
+    o.sta = v[9];
+    if (sleeping) return 0;
+    overlays.push_back(o);
+    return (uint64_t)o.w * o.h * _timing.pixelNs + (uint64_t)o.text.size() * _timing.glyphUs * 1000;
+  }
+
+  if (startsWith(cmd, "get ")) {
+    std::string lhs = trim(cmd.substr(4));
+    size_t dot = lhs.rfind('.');
+    std::string objName = dot == std::string::npos ? "" : lhs.substr(0, dot);
+    std::string attr = dot == std::string::npos ? lhs : lhs.substr(dot + 1);
+    int page = currentPage;
+    size_t pdot = objName.find('.');
+    if (pdot != std::string::npos) {
+      page = pageIndex(objName.substr(0, pdot));
+      objName = objName.substr(pdot + 1);
+    }
+    long value = 0;
+    std::string text;
+    bool isText = false;
+    if (objName.empty()) {
+      if (!sysvars.count(attr)) {
+        error = NEX_RET_INVALID_VAR;
+        return 0;
+      }
+      value = sysvars[attr];
+    }
+    else {
+      NexObject* o = find(page, objName);
+      if (!o || (!o->num.count(attr) && !o->text.count(attr))) {
+        error = NEX_RET_INVALID_VAR;
+        return 0;
+      }
+      isText = o->text.count(attr) > 0;
+      if (isText) text = o->text[attr];
+      else value = o->num[attr];
+    }
+    if (isText) {
+      _out.push_back(NEX_RET_STR);
+      _out.insert(_out.end(), text.begin(), text.end());
+    }
+    else {
+      uint32_t u = (uint32_t)value;
+      uint8_t msg[] = { NEX_RET_NUM, (uint8_t)u, (uint8_t)(u >> 8), (uint8_t)(u >> 16), (uint8_t)(u >> 24) };
+      _out.insert(_out.end(), msg, msg + sizeof(msg));
+    }
+    uint8_t end[] = { 0xFF, 0xFF, 0xFF };
+    _out.insert(_out.end(), end, end + sizeof(end));
+    return 0;
+  }
+
+  if (startsWith(cmd, "ref ") || startsWith(cmd, "vis ") || startsWith(cmd, "tsw ") || startsWith(cmd, "printh ")) return 0;
+
+  size_t eq = cmd.find('=');
+  if (eq == std::string::npos || eq == 0) {
+    error = NEX_RET_INVALID_CMD;
+    return 0;
+  }
+  return assign(trim(cmd.substr(0, eq)), cmd.substr(eq + 1), error);
+}
+
+// "[page.]obj.attr=value" or "sysvar=value".
+uint64_t NexEmulator::assign(const std::string& lhs, const std::string& rhs, uint8_t& error)
+{
+  long value;
+  std::string text;
+  bool isText = unquote(rhs, text);
+
+  size_t last = lhs.rfind('.');
+  if (last == std::string::npos) {
+    if (isText || !parseNumber(rhs, value)) {
+      error = NEX_RET_ASSIGN_FAILED;
+      return 0;
+    }
+    if (lhs == "sleep") {
+      bool wake = sleeping && value == 0;
+      sleeping = value != 0;
+      if (wake) {
+        overlays.clear();
+        return pageCost();
+      }
+    }
+    sysvars[lhs] = value;
+    return 0;
+  }
+
+  std::string attr = lhs.substr(last + 1);
+  std::string objName = lhs.substr(0, last);
+  int page = currentPage;
+  size_t dot = objName.find('.');
+  if (dot != std::string::npos) {
+    page = pageIndex(objName.substr(0, dot));
+    if (page < 0 && !_strict && startsWith(objName, "page")) {
+      page = atoi(objName.c_str() + 4);
+      while ((int)pages.size() <= page) addPage("page" + std::to_string(pages.size()));
+    }
+    objName = objName.substr(dot + 1);
+  }
+  if (page < 0) {
+    error = NEX_RET_INVALID_VAR;
+    return 0;
+  }
+
+  // Global variables (vscope global) answer to a bare name from any page.
+  NexObject* o = find(page, objName);
+  if (!o && dot == std::string::npos) {
+    for (size_t p = 0; p < pages.size() && !o; p++) {
+      NexObject* g = find(p, objName);
+      if (g && g->type == NEX_VARIABLE) o = g;
+    }
+  }
+  if (!o) {
+    if (_strict) {
+      error = NEX_RET_INVALID_VAR;
+      return 0;
+    }
+    o = &addObject(page, objName, NEX_UNKNOWN, -1, 0, 0, 0, 0);
+  }
+
+  if (attr == "txt") {
+    if (!isText) {
+      error = NEX_RET_ASSIGN_FAILED;
+      return 0;
+    }
+    o->text[attr] = text;
+  }
+  else {
+    if (isText || !parseNumber(rhs, value)) {
+      error = NEX_RET_ASSIGN_FAILED;
+      return 0;
+    }
+    o->num[attr] = value;
+  }
+
+  // Timer and variable settings don't draw anything; nor does anything off screen.
+  bool visible = !sleeping && (page == currentPage || o->type == NEX_VARIABLE);
+  if (!visible || attr == "en" || attr == "tim") return 0;
+  return redrawCost(*o);
+}
+
+void NexEmulator::touchWake()
+{
+  if (!sleeping || !sysvars["thup"]) return;
+  sleeping = false;
+  sysvars["sleep"] = 0;
+  overlays.clear();
+  uint64_t start = std::max(_nowNs, _busyNs);
+  _busyNs = start + pageCost();
+  uint8_t msg[] = { NEX_AUTO_WAKE, 0xFF, 0xFF, 0xFF };
+  reply(_busyNs, msg, sizeof(msg));
+}
+
+static void put(std::vector<uint8_t>& rgb, int width, int height, int x, int y, uint16_t c)
+{
+  if (x < 0 || y < 0 || x >= width || y >= height) return;
+  uint8_t* p = &rgb[(y * width + x) * 3];
+  p[0] = ((c >> 11) & 0x1F) * 255 / 31;
+  p[1] = ((c >> 5) & 0x3F) * 255 / 63;
+  p[2] = (c & 0x1F) * 255 / 31;
+}
+
+static void fill(std::vector<uint8_t>& rgb, int width, int height, int x, int y, int w, int h, uint16_t c)
+{
+  for (int j = y; j < y + h; j++) {
+    for (int i = x; i < x + w; i++) put(rgb, width, height, i, j, c);
+  }
+}
+
+// Left aligned, vertically centred, clipped to the box. Scaled up for taller boxes.
+static void text(std::vector<uint8_t>& rgb, int width, int height, int x, int y, int w, int h, const std::string& s, uint16_t c)
+{
+  int scale = h >= 24 ? 2 : 1;
+  int top = y + (h - 7 * scale) / 2;
+  int cx = x + 2;
+  for (unsigned char ch : s) {
+    if (cx + 5 * scale > x + w) break;
+    if (ch < 0x20 || ch > 0x7E) ch = '?';
+    const uint8_t* glyph = font5x7[ch - 0x20];
+    for (int col = 0; col < 5; col++) {
+      for (int row = 0; row < 7; row++) {
+        if (glyph[col] & (1 << row)) fill(rgb, width, height, cx + col * scale, top + row * scale, scale, scale, c);
+      }
+    }
+    cx += 6 * scale;
+  }
+}
+
+void NexEmulator::render(std::vector<uint8_t>& rgb, int page)
+{
+  rgb.assign(_width * _height * 3, 0);
+  if (sleeping || page < 0 || page >= (int)pages.size()) return;  // Backlight off.
+
+  for (const NexObject& o : pages[page].objects) {
+    if (o.w <= 0 || o.h <= 0) continue;
+    auto num = [&](const char* attr, long def) { auto it = o.num.find(attr); return it == o.num.end() ? def : it->second; };
+    uint16_t pco = num("pco", 65535);
+    uint16_t bco = num("bco", 0);
+
+    switch (o.type) {
+      case NEX_TEXT:
+      case NEX_NUMBER:
+      case NEX_BUTTON: {
+        fill(rgb, _width, _height, o.x, o.y, o.w, o.h, bco);
+        auto txt = o.text.find("txt");
+        std::string s = txt != o.text.end() ? txt->second : (o.type == NEX_NUMBER ? std::to_string(num("val", 0)) : "");
+        if (o.type == NEX_BUTTON && s.empty() && o.num.count("pic")) s = "pic " + std::to_string(num("pic", 0));
+        text(rgb, _width, _height, o.x, o.y, o.w, o.h, s, pco);
+        break;
+      }
+      case NEX_PICTURE:
+        fill(rgb, _width, _height, o.x, o.y, o.w, o.h, 0x4208);
+        text(rgb, _width, _height, o.x, o.y, o.w, o.h, "pic " + std::to_string(num("pic", 0)), 65535);
+        break;
+      case NEX_PROGRESS: {
+        fill(rgb, _width, _height, o.x, o.y, o.w, o.h, bco);
+        long val = std::min(100L, std::max(0L, num("val", 0)));
+        fill(rgb, _width, _height, o.x, o.y, o.w * val / 100, o.h, pco);
+        break;
+      }
+      case NEX_WAVEFORM:
+        fill(rgb, _width, _height, o.x, o.y, o.w, o.h, bco);
+        for (size_t ch = 0; ch < o.wave.size(); ch++) {
+          uint16_t c = num(("pco" + std::to_string(ch)).c_str(), 2016);
+          int prevY = -1;
+          for (size_t i = 0; i < o.wave[ch].size(); i++) {
+            int py = o.y + o.h - 1 - o.wave[ch][i] * o.h / 256;
+            int from = prevY < 0 ? py : std::min(prevY, py);
+            int to = prevY < 0 ? py : std::max(prevY, py);
+            fill(rgb, _width, _height, o.x + i, from, 1, to - from + 1, c);
+            prevY = py;
+          }
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  for (const NexOverlay& o : overlays) {
+    if (o.sta == 1) fill(rgb, _width, _height, o.x, o.y, o.w, o.h, o.bco);
+    text(rgb, _width, _height, o.x, o.y, o.w, o.h, o.text, o.pco);
+  }
+}
+
+bool NexEmulator::writePpm(const char* path, int page)
+{
+  std::vector<uint8_t> rgb;
+  render(rgb, page < 0 ? currentPage : page);
+  FILE* f = fopen(path, "wb");
+  if (!f) return false;
+  fprintf(f, "P6\n%d %d\n255\n", _width, _height);
+  fwrite(rgb.data(), 1, rgb.size(), f);
+  fclose(f);
+  return true;
+}
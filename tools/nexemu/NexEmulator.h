@@ -0,0 +1,147 @@
+#ifndef NexEmulator_h
+#define NexEmulator_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+
+// Host-side stand-in for the Nextion on Serial2, for judging display-path changes without a
+// panel. Feed it exactly the bytes the firmware would send (write() has Serial2's shape) and
+// it parses the instruction set the firmware uses, keeps page, component and waveform
+// state, answers get/page reports/wake codes through read(), and renders pages to PPM.
+//
+// Time is virtual. Bytes go out at the configured baud behind a TX FIFO the size of the
+// ESP32's, so a writer that gets too far ahead stalls just as loop() would. Each command is
+// then queued on the panel, which works through them one at a time at a cost from
+// NexTiming; bytes that arrive while its receive buffer is full are dropped, as on the real
+// thing. idleAtUs() is when the panel has caught up: the display-update latency of whatever
+// was just written.
+//
+// The timing defaults are rough figures for a K-series panel at 115200. Calibrate them
+// against a logic analyser trace before trusting absolute numbers; comparisons between two
+// versions of the firmware hold either way.
+
+struct NexTiming
+{
+  uint32_t baud = 115200;
+  uint32_t txFifoBytes = 128;     // ESP32 UART hardware FIFO; Serial2 has no TX ring buffer by default.
+  uint32_t rxBufferBytes = 1024;  // Panel's serial buffer.
+  uint32_t commandUs = 60;        // Parse and dispatch, any command.
+  uint32_t perByteUs = 1;         // On top of that, per command byte.
+  uint32_t pixelNs = 12;          // Redrawing a component or clearing an area.
+  uint32_t glyphUs = 25;          // Per character rendered.
+  uint32_t waveAddUs = 40;        // One waveform point, including drawing it.
+  uint32_t pageUs = 30000;        // Page switch, before redrawing its components.
+};
+
+enum NexType { NEX_TEXT, NEX_NUMBER, NEX_BUTTON, NEX_PICTURE, NEX_PROGRESS, NEX_WAVEFORM, NEX_TIMER, NEX_VARIABLE, NEX_UNKNOWN };
+
+struct NexObject
+{
+  std::string name;
+  NexType type = NEX_UNKNOWN;
+  int id = -1;
+  int x = 0, y = 0, w = 0, h = 0;
+  std::map<std::string, std::string> text;  // txt
+  std::map<std::string, long> num;          // val, pco, bco, pic, ...
+  std::vector<std::vector<uint8_t>> wave;   // Waveform channels, oldest point first.
+};
+
+struct NexPageState
+{
+  std::string name;
+  std::vector<NexObject> objects;
+};
+
+// Instant drawing commands (xstr) paint over the page until it's next refreshed.
+struct NexOverlay
+{
+  int x, y, w, h;
+  uint16_t pco, bco;
+  int sta;
+  std::string text;
+};
+
+struct NexCommandRecord
+{
+  std::string text;
+  uint64_t rxDoneUs;   // Last terminator byte in, since the emulator started.
+  uint64_t startUs;    // Panel got to it.
+  uint64_t doneUs;
+  uint8_t error;       // 0 ok, else the Nextion return code.
+};
+
+class NexEmulator
+{
+  public:
+    NexEmulator(int width = 480, int height = 320, const NexTiming& timing = NexTiming());
+
+    // HMI layout. Without one, objects spring into being on first assignment (and can't be drawn).
+    int addPage(const std::string& name);
+    NexObject& addObject(int page, const std::string& name, NexType type, int id, int x, int y, int w, int h);
+    bool loadLayout(const char* path);
+
+    // Serial2's side.
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buf, size_t len);
+    int available();
+    int read();
+    int peek();
+    void flush();
+
+    // Clock.
+    void advanceUs(uint64_t us) { _nowNs += us * 1000; }
+    uint64_t nowUs() { return _nowNs / 1000; }
+    uint64_t wireDoneUs() { return _lineFreeNs / 1000; }
+    uint64_t idleAtUs() { return (_busyNs > _lineFreeNs ? _busyNs : _lineFreeNs) / 1000; }
+    void waitIdle();
+
+    // The panel's side.
+    void touchWake();
+    bool writePpm(const char* path, int page = -1);
+    NexObject* find(int page, const std::string& name);
+    int pageIndex(const std::string& name);
+
+    int currentPage;
+    bool sleeping;
+    bool reportPages;  // Send EasyNextion's 23 02 50 <page> on a page change, as the HMI's preinit does.
+    std::map<std::string, long> sysvars;  // dim, bkcmd, thup, thsp, rtc0..6, ...
+    std::vector<NexPageState> pages;
+    std::vector<NexOverlay> overlays;
+    std::vector<NexCommandRecord> log;
+
+    uint64_t bytesIn;
+    uint64_t bytesDropped;
+    uint64_t writerStallUs() { return _stallNs / 1000; }  // Time write() would have blocked the caller.
+    uint32_t errors;
+
+  private:
+    // Costs and times below are in ns.
+    void command(const std::string& cmd, uint64_t rxDoneNs, size_t len);
+    uint64_t execute(const std::string& cmd, uint8_t& error);
+    uint64_t assign(const std::string& lhs, const std::string& rhs, uint8_t& error);
+    uint64_t redrawCost(const NexObject& o);
+    uint64_t pageCost();
+    void reply(uint64_t atNs, const uint8_t* bytes, size_t len);
+    void replyCode(uint64_t atNs, uint8_t code);
+    void render(std::vector<uint8_t>& rgb, int page);
+
+    int _width, _height;
+    NexTiming _timing;
+    bool _strict;           // A layout was loaded, so unknown names are errors.
+    uint64_t _nowNs;
+    uint64_t _lineFreeNs;   // Last byte queued for the wire finishes here.
+    uint64_t _busyNs;       // Panel finishes its last queued command.
+    uint64_t _stallNs;
+    std::string _partial;
+    int _ffs;
+    std::deque<std::pair<uint64_t, size_t>> _queued;  // (start, bytes) of commands still in the rx buffer.
+    size_t _queuedBytes;
+    std::vector<uint8_t> _out;                        // Replies from the command being executed.
+    std::deque<std::pair<uint64_t, uint8_t>> _replies;
+};
+
+#endif
@@ -0,0 +1,26 @@
+#include "Arduino.h"
+#include "NexEmulator.h"
+
+#ifndef NexStream_h
+#define NexStream_h
+
+// NexEmulator as an Arduino Stream, so firmware code that takes Serial2 as a Stream (NexUI)
+// can be pointed at the emulator on the host. Needs an Arduino.h that has Stream, as
+// test/stubs does.
+
+class NexStream : public Stream
+{
+  public:
+    NexStream(NexEmulator& nex) : _nex(nex) {}
+    size_t write(uint8_t c) override { return _nex.write(c); }
+    size_t write(const uint8_t* buf, size_t len) override { return _nex.write(buf, len); }
+    int available() override { return _nex.available(); }
+    int read() override { return _nex.read(); }
+    int peek() override { return _nex.peek(); }
+    void flush() override { _nex.flush(); }
+
+  private:
+    NexEmulator& _nex;
+};
+
+#endif
@@ -0,0 +1,152 @@
+// Replays display traffic through NexEmulator and reports how long the panel takes over it.
+//
+//   make -C tools/nexemu   (or g++ -std=c++11 -O2 -o nexreplay tools/nexemu/*.cpp)
+//   nexreplay [-l layout] [-b baud] [-o prefix] [-v] capture.bin
+//   nexreplay [-l layout] [-b baud] [-o prefix] [-v] -s script.nex
+//
+// A capture is the raw bytes sent to the Nextion, e.g. from a USB-serial adapter listening on
+// its RX pin. It's replayed as one burst, which is what a refresh cycle looks like from
+// loop(). A script has one command per line (the 0xFF terminator is added) plus:
+//   @mark <label>   report wire and panel time since the previous mark
+//   @wait <ms>      let virtual time pass
+//   @idle           wait until the panel has caught up
+//   @touch          touch the sleeping panel
+//   @snap <file>    write the current page as PPM
+// With -o, the current page is written to <prefix>-page<N>.ppm at the end.
+
+#include "NexEmulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static void usage()
+{
+  fprintf(stderr, "usage: nexreplay [-l layout] [-b baud] [-o prefix] [-v] (capture.bin | -s script.nex)\n");
+  exit(2);
+}
+
+struct Mark {
+  std::string label;
+  uint64_t startUs;
+  size_t firstCommand;
+};
+
+static void drainReplies(NexEmulator& nex, bool verbose)
+{
+  while (nex.available()) {
+    int c = nex.read();
+    if (verbose) printf("  <- %02X\n", c);
+  }
+}
+
+// Wire time is until the last byte is out; panel time until it has acted on all of it.
+static void reportSince(NexEmulator& nex, const Mark& m)
+{
+  uint64_t wire = nex.wireDoneUs() > m.startUs ? nex.wireDoneUs() - m.startUs : 0;
+  uint64_t panel = nex.idleAtUs() > m.startUs ? nex.idleAtUs() - m.startUs : 0;
+  printf("%-24s %5zu cmds  wire %8.2f ms  panel %8.2f ms\n", m.label.c_str(), nex.log.size() - m.firstCommand, wire / 1000.0, panel / 1000.0);
+}
+
+int main(int argc, char** argv)
+{
+  const char* layout = NULL;
+  const char* prefix = NULL;
+  const char* path = NULL;
+  bool script = false;
+  bool verbose = false;
+  NexTiming timing;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-l") && i + 1 < argc) layout = argv[++i];
+    else if (!strcmp(argv[i], "-b") && i + 1 < argc) timing.baud = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-o") && i + 1 < argc) prefix = argv[++i];
+    else if (!strcmp(argv[i], "-s")) script = true;
+    else if (!strcmp(argv[i], "-v")) verbose = true;
+    else if (argv[i][0] == '-' || path) usage();
+    else path = argv[i];
+  }
+  if (!path || timing.baud == 0) usage();
+
+  NexEmulator nex(480, 320, timing);
+  if (layout && !nex.loadLayout(layout)) {
+    fprintf(stderr, "can't load layout %s\n", layout);
+    return 1;
+  }
+
+  FILE* f = fopen(path, script ? "r" : "rb");
+  if (!f) {
+    perror(path);
+    return 1;
+  }
+
+  Mark mark = { "(start)", 0, 0 };  // Anything before the first @mark.
+  Mark all = { "(total)", 0, 0 };
+  if (!script) {
+    std::vector<uint8_t> bytes;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) bytes.insert(bytes.end(), buf, buf + n);
+    nex.write(bytes.data(), bytes.size());
+  }
+  else {
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+      std::string l(line);
+      while (!l.empty() && (l.back() == '\n' || l.back() == '\r')) l.pop_back();
+      if (l.empty() || l[0] == '#') continue;
+
+      if (l[0] != '@') {
+        nex.write((const uint8_t*)l.data(), l.size());
+        const uint8_t end[] = { 0xFF, 0xFF, 0xFF };
+        nex.write(end, sizeof(end));
+        continue;
+      }
+      drainReplies(nex, verbose);
+      if (!strncmp(l.c_str(), "@mark", 5)) {
+        if (mark.firstCommand < nex.log.size()) reportSince(nex, mark);
+        mark.label = l.size() > 6 ? l.substr(6) : "";
+        mark.startUs = nex.nowUs();
+        mark.firstCommand = nex.log.size();
+      }
+      else if (!strncmp(l.c_str(), "@wait", 5)) nex.advanceUs(atol(l.c_str() + 5) * 1000);
+      else if (!strcmp(l.c_str(), "@idle")) nex.waitIdle();
+      else if (!strcmp(l.c_str(), "@touch")) nex.touchWake();
+      else if (!strncmp(l.c_str(), "@snap ", 6)) {
+        nex.waitIdle();
+        if (!nex.writePpm(l.c_str() + 6)) perror(l.c_str() + 6);
+      }
+      else fprintf(stderr, "unknown directive %s\n", l.c_str());
+    }
+    if (mark.firstCommand < nex.log.size()) reportSince(nex, mark);
+  }
+  fclose(f);
+
+  nex.waitIdle();
+  drainReplies(nex, verbose);
+  reportSince(nex, all);
+  printf("%llu bytes, %llu dropped, %u errors, writer stalled %.2f ms\n",
+         (unsigned long long)nex.bytesIn, (unsigned long long)nex.bytesDropped, nex.errors, nex.writerStallUs() / 1000.0);
+
+  // Where the panel's time went.
+  std::vector<const NexCommandRecord*> slowest;
+  for (const NexCommandRecord& r : nex.log) slowest.push_back(&r);
+  std::sort(slowest.begin(), slowest.end(), [](const NexCommandRecord* a, const NexCommandRecord* b) { return a->doneUs - a->startUs > b->doneUs - b->startUs; });
+  printf("slowest:\n");
+  for (size_t i = 0; i < slowest.size() && i < 5; i++) {
+    printf("  %8.2f ms  %s\n", (slowest[i]->doneUs - slowest[i]->startUs) / 1000.0, slowest[i]->text.c_str());
+  }
+  if (verbose) {
+    for (const NexCommandRecord& r : nex.log) {
+      printf("%10.3f %10.3f %10.3f %02X %s\n", r.rxDoneUs / 1000.0, r.startUs / 1000.0, r.doneUs / 1000.0, r.error, r.text.c_str());
+    }
+  }
+
+  if (prefix) {
+    std::string out = std::string(prefix) + "-page" + std::to_string(nex.currentPage) + ".ppm";
+    if (!nex.writePpm(out.c_str())) perror(out.c_str());
+  }
+  return 0;
+}